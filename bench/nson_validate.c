@@ -0,0 +1,42 @@
+/*
+ * portableproplib.c
+ * Copyright (C) 2018 tox <tox@rootkit>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#define _GNU_SOURCE
+
+#include "../test/test.h"
+
+#include "../src/nson.h"
+#include "mmap.h"
+#include <assert.h>
+
+// Make linter happy:
+#ifndef BENCH_JSON
+#define BENCH_JSON "/dev/null"
+#endif
+
+/*
+ * Compare with naiv_json in naiv.c, which only matches brackets and skips
+ * strings without checking them.
+ */
+void
+bench_nson_json_validate() {
+	int rv;
+	char *doc = 0;
+	size_t len, f_len = 0;
+	NsonError err = {0};
+
+	rv = mmap_file(BENCH_JSON, (void **)&doc, &len, &f_len);
+	assert(rv);
+	rv = nson_json_validate(doc, f_len, &err);
+	assert(rv >= 0);
+
+	(void)rv;
+}
+
+DEFINE
+TEST(bench_nson_json_validate);
+DEFINE_END
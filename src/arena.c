@@ -0,0 +1,150 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (16 * 1024 * 1024)
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+struct NsonArenaChunk {
+	struct NsonArenaChunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+static struct NsonArenaChunk *
+arena_chunk_new(NsonArena *arena, size_t size) {
+	struct NsonArenaChunk *chunk;
+
+	if (size > SIZE_MAX - sizeof(*chunk)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	chunk = malloc(sizeof(*chunk) + size);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+void *
+__nson_arena_alloc(NsonArena *arena, size_t size) {
+	void *p;
+	size_t chunk_size;
+	struct NsonArenaChunk *chunk = arena->chunks;
+
+	if (size > SIZE_MAX - ARENA_ALIGN) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		// Every new chunk doubles the previous one to keep the number of
+		// chunks logarithmic to the size of the document.
+		chunk_size = chunk ? chunk->size * 2 : ARENA_MIN_CHUNK;
+		if (chunk_size > ARENA_MAX_CHUNK) {
+			chunk_size = ARENA_MAX_CHUNK;
+		}
+		if (chunk_size < size) {
+			chunk_size = size;
+		}
+		chunk = arena_chunk_new(arena, chunk_size);
+		if (chunk == NULL) {
+			return NULL;
+		}
+	}
+
+	p = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+char *
+__nson_arena_strndup(NsonArena *arena, const char *src, size_t len) {
+	char *dest;
+
+	if (len == SIZE_MAX) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	dest = __nson_arena_alloc(arena, len + 1);
+	if (dest == NULL) {
+		return NULL;
+	}
+	memcpy(dest, src, len);
+	dest[len] = '\0';
+	return dest;
+}
+
+/*
+ * Releases all allocations of @p arena but keeps its memory for reuse. If
+ * the allocations spanned several chunks, they are merged into a single
+ * chunk of the combined size, so the same workload fits without further
+ * allocations.
+ */
+void
+__nson_arena_reset(NsonArena *arena) {
+	size_t size = 0;
+	struct NsonArenaChunk *chunk = arena->chunks;
+
+	if (chunk && chunk->next == NULL) {
+		chunk->used = 0;
+		return;
+	}
+	for (; chunk; chunk = chunk->next) {
+		size += chunk->size;
+	}
+	__nson_arena_clean(arena);
+	if (size) {
+		// A failure is not fatal, the next allocation retries
+		arena_chunk_new(arena, size);
+	}
+}
+
+void
+__nson_arena_clean(NsonArena *arena) {
+	struct NsonArenaChunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
@@ -40,47 +40,144 @@ cmp_stable(const void *a, const void *b) {
 	return rv ? rv : (na - nb);
 }
 
-static int
-mem_capacity(Nson *nson, const size_t size) {
-	Nson *arr;
-	const size_t old = nson_arr_len(nson);
+static bool
+mem_fits(size_t cap, size_t size) {
+	// lengths are stored in 32 bits
+	if (cap > UINT32_MAX ||
+		cap > (SIZE_MAX - sizeof(NsonContainerMem)) / size) {
+		errno = ENOMEM;
+		return false;
+	}
+	return true;
+}
 
-	if (size == old) {
-		return size;
+void *
+__nson_mem_resize(void *elements, size_t cap, size_t size) {
+	NsonContainerMem *mem = elements ? NSON_MEM(elements) : NULL;
+	NsonContainerMem *new_mem;
+
+	assert(cap > 0);
+	if (!mem_fits(cap, size)) {
+		return NULL;
+	}
+	new_mem = realloc(mem, sizeof(*mem) + cap * size);
+	if (new_mem == NULL) {
+		return NULL;
 	}
+	if (mem == NULL) {
+		new_mem->index = NULL;
+	}
+	new_mem->cap = cap;
+	return new_mem + 1;
+}
 
-	arr = nson->a.arr;
-	nson->a.len = size;
+void *
+__nson_mem_arena(NsonArena *arena, size_t cap, size_t size) {
+	NsonContainerMem *mem;
 
-	if (size && size > SIZE_MAX / sizeof(*arr)) {
-		errno = ENOMEM;
+	if (!mem_fits(cap, size)) {
+		return NULL;
+	}
+	mem = __nson_arena_alloc(arena, sizeof(*mem) + cap * size);
+	if (mem == NULL) {
+		return NULL;
+	}
+	mem->cap = cap;
+	mem->index = NULL;
+	return mem + 1;
+}
+
+void
+__nson_mem_free(void *elements) {
+	if (elements) {
+		free(NSON_MEM(elements));
+	}
+}
+
+static size_t
+arr_cap(const Nson *nson) {
+	return nson->a.arr ? NSON_MEM(nson->a.arr)->cap : 0;
+}
+
+static int
+mem_capacity(Nson *nson, const size_t cap) {
+	Nson *arr;
+
+	NSON_LAZY_LOAD(nson);
+	if (nson->c.flags & NSON_FLAG_ARENA) {
+		// arena storage can not be reallocated
+		errno = EPERM;
 		return -1;
 	}
-	arr = reallocarray(arr, size, sizeof(*arr));
+	if (cap <= arr_cap(nson)) {
+		return 0;
+	}
+	arr = __nson_mem_resize(nson->a.arr, cap, sizeof(*arr));
 	if (!arr) {
-		nson->a.len = old;
 		return -1;
 	}
-	if (size > old)
-		memset(&arr[old], 0, sizeof(*arr) * (size - old));
 
 	nson->a.arr = arr;
-	return size;
+	return 0;
+}
+
+static int
+mem_grow(Nson *nson, const size_t size) {
+	size_t cap = arr_cap(nson);
+
+	// arena containers are rejected by mem_capacity()
+	if (size <= cap && !(nson->c.flags & NSON_FLAG_ARENA)) {
+		return 0;
+	}
+	for (cap = cap < 8 ? 8 : cap; cap < size;) {
+		cap = cap > UINT32_MAX / 2 ? size : cap * 2;
+	}
+	return mem_capacity(nson, cap);
 }
 
 int
 __nson_arr_clone(Nson *array) {
 	int rv = 0;
-	Nson *arr = array->a.arr;
 	size_t len = nson_arr_len(array);
+	Nson *arr = array->a.arr;
 
 	array->a.arr = NULL;
 	array->a.len = 0;
+	array->c.flags &= ~NSON_FLAG_ARENA;
 
 	rv = mem_capacity(array, len);
 	if (rv < 0 || array->a.arr == NULL)
 		return rv;
 	memcpy(array->a.arr, arr, len * sizeof(*arr));
+	array->a.len = len;
+
+	return rv;
+}
+
+int
+__nson_arr_init_move(
+		Nson *array, Nson *values, size_t len, NsonArena *arena) {
+	int rv = 0;
+
+	nson_init(array, NSON_ARR);
+	if (arena && len) {
+		array->a.arr = __nson_mem_arena(arena, len, sizeof(*values));
+		if (array->a.arr == NULL) {
+			return -1;
+		}
+		array->c.flags |= NSON_FLAG_ARENA;
+	} else if (arena) {
+		array->c.flags |= NSON_FLAG_ARENA;
+	} else {
+		rv = mem_capacity(array, len);
+	}
+	if (rv < 0) {
+		return rv;
+	}
+	if (len) {
+		memcpy(array->a.arr, values, len * sizeof(*values));
+	}
+	array->a.len = len;
 
 	return rv;
 }
@@ -95,12 +192,14 @@ size_t
 nson_arr_len(const Nson *array) {
 	assert(nson_type(array) == NSON_ARR);
 
+	NSON_LAZY_LOAD(array);
 	return array->a.len;
 }
 
 Nson *
 nson_arr_get(const Nson *array, off_t index) {
 	assert(nson_type(array) == NSON_ARR);
+	NSON_LAZY_LOAD(array);
 	assert(index < nson_arr_len(array));
 
 	return &array->a.arr[index];
@@ -113,14 +212,24 @@ nson_arr_push(Nson *array, Nson *value) {
 	Nson *new_elem;
 	size_t old_len = nson_arr_len(array);
 
-	mem_capacity(array, old_len + 1);
+	if (mem_grow(array, old_len + 1) < 0) {
+		return -1;
+	}
 
 	new_elem = &array->a.arr[old_len];
 	nson_move(new_elem, value);
+	array->a.len = old_len + 1;
 
 	return 0;
 }
 
+int
+nson_arr_reserve(Nson *array, size_t capacity) {
+	assert(nson_type(array) == NSON_ARR);
+
+	return mem_capacity(array, capacity);
+}
+
 int
 nson_arr_push_int(Nson *array, int value) {
 	Nson v = {0};
@@ -180,12 +289,13 @@ nson_arr_concat(Nson *array_1, Nson *array_2) {
 	const size_t len_1 = nson_arr_len(array_1);
 	const size_t len_2 = nson_arr_len(array_2);
 
-	if (mem_capacity(array_1, len_1 + len_2) < 0) {
+	if (mem_grow(array_1, len_1 + len_2) < 0) {
 		return -1;
 	}
 
 	memcpy(&array_1->a.arr[len_1], array_2->a.arr,
 		   len_2 * sizeof(*array_2->a.arr));
+	array_1->a.len = len_1 + len_2;
 
 	// Set length to 0 to avoid cleanup of array elements
 	array_2->a.len = 0;
@@ -205,6 +315,25 @@ nson_arr_sort(Nson *nson) {
 	return 0;
 }
 
+int
+__nson_arr_shrink(Nson *array) {
+	Nson *arr;
+	size_t len = nson_arr_len(array);
+
+	if (len == arr_cap(array) || array->c.flags & NSON_FLAG_ARENA) {
+		return 0;
+	} else if (len == 0) {
+		__nson_mem_free(array->a.arr);
+		arr = NULL;
+	} else if ((arr = __nson_mem_resize(array->a.arr, len, sizeof(*arr))) ==
+			   NULL) {
+		return -1;
+	}
+
+	array->a.arr = arr;
+	return 0;
+}
+
 int
 __nson_arr_clean(Nson *nson) {
 	int i, rv = 0;
@@ -212,14 +341,14 @@ __nson_arr_clean(Nson *nson) {
 	for (i = 0; i < nson_arr_len(nson); i++) {
 		rv |= nson_clean(nson_arr_get(nson, i));
 	}
-	free(nson->a.arr);
+	__nson_mem_free(nson->a.arr);
 
 	return rv;
 }
 
 int
 __nson_arr_serialize(
-		FILE *out, const Nson *array, const NsonSerializerInfo *info,
+		NsonWriter *out, const Nson *array, const NsonSerializerInfo *info,
 		enum NsonOptions options) {
 	int i;
 	size_t size = nson_arr_len(array);
@@ -227,11 +356,13 @@ __nson_arr_serialize(
 
 	for (i = 0; i < size; i++) {
 		element = nson_arr_get(array, i);
-		info->serializer(out, element, options | NSON_SKIP_HEADER);
+		if (info->serializer(out, element, options | NSON_SKIP_HEADER) < 0) {
+			return -1;
+		}
 		if (i + 1 != size) {
-			fputs(info->seperator, out);
+			__nson_writer_puts(out, info->seperator);
 		}
 	}
 
-	return 0;
+	return out->error ? -1 : 0;
 }
@@ -47,8 +47,10 @@ __nson_buf_new(size_t siz) {
 	if (buf == NULL) {
 		return NULL;
 	}
-	memset(buf, 0, sizeof(char) * siz + sizeof(NsonBuf));
+	// The content is left uninitialized, callers fill it completely
+	memset(buf, 0, sizeof(NsonBuf));
 	buf->siz = siz;
+	buf->buf[siz] = 0;
 	return __nson_buf_retain(buf);
 }
 
@@ -81,29 +83,20 @@ __nson_buf_shrink(NsonBuf *buf, size_t new_siz) {
 	return new_siz;
 }
 
+/*
+ * Buffers are shared between trees by nson_clone() and between the
+ * records of a document by key interning. The reference count is atomic,
+ * so threads may release the records of one document concurrently.
+ */
 NsonBuf *
 __nson_buf_retain(NsonBuf *buf) {
-	buf->count++;
+	__atomic_add_fetch(&buf->count, 1, __ATOMIC_RELAXED);
 	return buf;
 }
 
 void
 __nson_buf_release(NsonBuf *buf) {
-	buf->count--;
-	if (buf->count == 0) {
+	if (__atomic_sub_fetch(&buf->count, 1, __ATOMIC_ACQ_REL) == 0) {
 		free(buf);
 	}
 }
-
-int
-__nson_buf_cmp(const NsonBuf *a, const NsonBuf *b) {
-	int rv;
-	const int len_a = __nson_buf_siz(a);
-	const int len_b = __nson_buf_siz(b);
-	const int min_len = MIN(len_a, len_b);
-
-	rv = memcmp(a->buf, b->buf, min_len);
-	if (rv == 0 && len_a != len_b)
-		rv = SCAL_CMP(len_a, len_b);
-	return rv;
-}
@@ -0,0 +1,163 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+/*
+ * The builder collects the values of all open containers on a single
+ * scratch stack. A container is only allocated when it is closed, at
+ * which point the number of its children is known and they can be moved
+ * into an exactly sized buffer in one go.
+ */
+
+static int
+scratch_capacity(void **arr, size_t *cap, const size_t size, size_t elem_siz) {
+	void *new_arr;
+	size_t new_cap = *cap ? *cap : 16;
+
+	if (size <= *cap) {
+		return 0;
+	}
+	for (; new_cap < size; new_cap *= 2) {
+		if (new_cap > SIZE_MAX / 2) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	new_arr = reallocarray(*arr, new_cap, elem_siz);
+	if (new_arr == NULL) {
+		return -1;
+	}
+	*arr = new_arr;
+	*cap = new_cap;
+	return 0;
+}
+
+int
+__nson_builder_push(NsonBuilder *builder, Nson *value) {
+	if (scratch_capacity(
+				(void **)&builder->values, &builder->values_cap,
+				builder->len + 1, sizeof(*builder->values)) < 0) {
+		nson_clean(value);
+		return -1;
+	}
+	nson_move(&builder->values[builder->len++], value);
+	return 0;
+}
+
+int
+__nson_builder_open(NsonBuilder *builder, enum NsonType type) {
+	NsonBuilderFrame *frame;
+
+	assert(type == NSON_ARR || type == NSON_OBJ);
+	if (scratch_capacity(
+				(void **)&builder->frames, &builder->frames_cap,
+				builder->depth + 1, sizeof(*builder->frames)) < 0) {
+		return -1;
+	}
+	frame = &builder->frames[builder->depth++];
+	frame->start = builder->len;
+	frame->type = type;
+	return 0;
+}
+
+int
+__nson_builder_close(NsonBuilder *builder, enum NsonType type) {
+	int rv;
+	size_t start, len;
+	Nson container = {0};
+	NsonBuilderFrame *frame;
+
+	if (builder->depth == 0) {
+		return -1;
+	}
+	frame = &builder->frames[builder->depth - 1];
+	if (frame->type != type) {
+		return -1;
+	}
+	start = frame->start;
+	len = builder->len - start;
+	if (type == NSON_OBJ && len % 2 != 0) {
+		return -1;
+	}
+
+	rv = __nson_arr_init_move(
+			&container, &builder->values[start], len, builder->arena);
+	if (rv < 0) {
+		return rv;
+	}
+	builder->len = start;
+	builder->depth--;
+	if (type == NSON_OBJ) {
+		nson_obj_from_arr(&container);
+		// arena objects can not build their index on the first lookup
+		if (builder->arena &&
+			__nson_obj_index_arena(&container, builder->arena) < 0) {
+			return -1;
+		}
+	}
+
+	return __nson_builder_push(builder, &container);
+}
+
+int
+__nson_builder_finish(NsonBuilder *builder, Nson *nson) {
+	if (builder->depth != 0 || builder->len != 1) {
+		return -1;
+	}
+	nson_move(nson, &builder->values[0]);
+	builder->len = 0;
+	return 0;
+}
+
+/*
+ * Drops the values of an aborted parse but keeps the scratch stacks.
+ */
+void
+__nson_builder_reset(NsonBuilder *builder) {
+	size_t i;
+
+	for (i = 0; i < builder->len; i++) {
+		nson_clean(&builder->values[i]);
+	}
+	builder->len = 0;
+	builder->depth = 0;
+}
+
+void
+__nson_builder_clean(NsonBuilder *builder) {
+	__nson_builder_reset(builder);
+	free(builder->values);
+	free(builder->frames);
+	memset(builder, 0, sizeof(*builder));
+}
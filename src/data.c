@@ -39,10 +39,44 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+/*
+ * Decodes escape sequences left by the JSON parser. This is the only place
+ * that modifies data through a const pointer.
+ */
+static void
+data_decode(const Nson *nson) {
+	NsonData *data = (NsonData *)&nson->d;
+	NsonBuf *buf = data->buf;
+	char *ref;
+
+	if (nson->c.flags & NSON_FLAG_INLINE) {
+		// inline strings are decoded when they are created
+		return;
+	} else if (nson->c.flags & NSON_FLAG_BORROWED) {
+		if (!(nson->c.flags & NSON_FLAG_ESCAPED)) {
+			return;
+		}
+		ref = (char *)data->ref;
+		data->len = __nson_json_unescape(ref, ref, data->len);
+		ref[data->len] = '\0';
+		data->c.flags &= ~NSON_FLAG_ESCAPED;
+	} else if (buf != NULL && buf->escaped) {
+		ref = __nson_buf(buf);
+		__nson_buf_shrink(buf, __nson_json_unescape(ref, ref, buf->siz));
+		buf->escaped = false;
+	}
+}
+
 size_t
 nson_data_len(const Nson *nson) {
 	assert(nson_type(nson) == NSON_STR || nson_type(nson) == NSON_BLOB);
 
+	data_decode(nson);
+	if (nson->c.flags & NSON_FLAG_INLINE) {
+		return NSON_INLINE_SIZE - nson->s.str[NSON_INLINE_SIZE];
+	} else if (nson->c.flags & NSON_FLAG_BORROWED || nson->d.buf == NULL) {
+		return nson->d.len;
+	}
 	return __nson_buf_siz(nson->d.buf);
 }
 
@@ -50,9 +84,40 @@ const char *
 nson_data(const Nson *nson) {
 	assert(nson_type(nson) == NSON_STR || nson_type(nson) == NSON_BLOB);
 
+	data_decode(nson);
+	if (nson->c.flags & NSON_FLAG_INLINE) {
+		return nson->s.str;
+	} else if (nson->c.flags & NSON_FLAG_BORROWED || nson->d.buf == NULL) {
+		return nson->d.ref;
+	}
 	return __nson_buf(nson->d.buf);
 }
 
+int
+__nson_data_cmp(const Nson *a, const Nson *b) {
+	int rv;
+	const size_t len_a = nson_data_len(a);
+	const size_t len_b = nson_data_len(b);
+
+	rv = memcmp(nson_data(a), nson_data(b), MIN(len_a, len_b));
+	if (rv == 0 && len_a != len_b)
+		rv = SCAL_CMP(len_a, len_b);
+	return rv;
+}
+
+int
+__nson_data_replace(Nson *nson, NsonBuf *buf) {
+	if (!(nson->c.flags & (NSON_FLAG_INLINE | NSON_FLAG_BORROWED)) &&
+		nson->d.buf) {
+		__nson_buf_release(nson->d.buf);
+	}
+	nson->c.flags &=
+			~(NSON_FLAG_INLINE | NSON_FLAG_BORROWED | NSON_FLAG_ESCAPED);
+	nson->d.buf = buf;
+	nson->d.len = 0;
+	return 0;
+}
+
 enum NsonType
 nson_type(const Nson *nson) {
 	return nson->c.type;
@@ -67,6 +132,11 @@ nson_move(Nson *nson, Nson *src) {
 
 static int
 nson_mapper_clone(off_t index, Nson *nson, void *user_data) {
+	if (nson->c.flags & NSON_FLAG_LAZY) {
+		// the source of a lazy container belongs to its document
+		return __nson_lazy_copy(nson);
+	}
+
 	switch (nson_type(nson)) {
 	case NSON_ARR:
 		__nson_arr_clone(nson);
@@ -75,13 +145,27 @@ nson_mapper_clone(off_t index, Nson *nson, void *user_data) {
 		__nson_obj_clone(nson);
 		for (int i = 0, len = nson_obj_size(nson); i < len; i++) {
 			NsonObjectEntry *entry = __nson_obj_get_entry(nson, i);
-			__nson_buf_retain(entry->key.d.buf);
+			nson_mapper_clone(0, &entry->key, NULL);
 			nson_mapper_clone(0, &entry->value, NULL);
 		}
 		break;
 	case NSON_STR:
 	case NSON_BLOB:
-		__nson_buf_retain(nson->d.buf);
+		if (nson->c.flags & NSON_FLAG_INLINE) {
+			// noop
+		} else if (nson->c.flags & NSON_FLAG_ESCAPED) {
+			// borrowed data must not outlive its document, so copy it. The
+			// source still decodes its own bytes, so the copy is taken
+			// from the escaped data and decoded separately.
+			__nson_parse_json_string(nson, nson->d.ref, nson->d.len);
+		} else if (nson->c.flags & NSON_FLAG_BORROWED) {
+			nson_init_data(nson, nson->d.ref, nson->d.len, nson_type(nson));
+		} else if (nson->d.buf) {
+			// decode escapes before the buffer is shared, so reading the
+			// clone never writes to memory the source can see
+			data_decode(nson);
+			__nson_buf_retain(nson->d.buf);
+		}
 		break;
 	case NSON_POINTER:
 		__nson_ptr_retain(nson->p.ref);
@@ -123,15 +207,73 @@ __nson_init_buf(Nson *nson, NsonBuf *val, enum NsonType info) {
 	return rv;
 }
 
+int
+__nson_init_ref(Nson *nson, const char *val, size_t len, enum NsonType info) {
+	int rv;
+
+	if (len > UINT32_MAX) {
+		// callers fall back to copying the data
+		errno = EOVERFLOW;
+		return -1;
+	}
+	rv = nson_init(nson, info);
+	if (rv < 0) {
+		return rv;
+	}
+
+	nson->c.flags |= NSON_FLAG_BORROWED;
+	nson->d.ref = val;
+	nson->d.len = len;
+	return rv;
+}
+
+/*
+ * Initializes @p nson with an inline copy of @p val. @p len must not
+ * exceed NSON_INLINE_SIZE. Returns the buffer the caller may fill instead
+ * if @p val is NULL.
+ */
+char *
+__nson_init_inline(
+		Nson *nson, const char *val, size_t len, enum NsonType info) {
+	assert(len <= NSON_INLINE_SIZE);
+
+	nson_init(nson, info);
+	nson->c.flags |= NSON_FLAG_INLINE;
+	if (val) {
+		memcpy(nson->s.str, val, len);
+	}
+	__nson_inline_set_len(nson, len);
+	return nson->s.str;
+}
+
+/*
+ * Sets the length of an inline string. The length is stored as its
+ * distance to NSON_INLINE_SIZE in the last byte, which is zero when the
+ * string uses all of it.
+ */
+void
+__nson_inline_set_len(Nson *nson, size_t len) {
+	assert(len <= NSON_INLINE_SIZE);
+
+	nson->s.str[NSON_INLINE_SIZE] = NSON_INLINE_SIZE - len;
+	nson->s.str[len] = '\0';
+}
+
 int
 nson_init_data(
 		Nson *nson, const char *val, const size_t len, enum NsonType info) {
-	int rv = nson_init(nson, info);
+	int rv;
+
+	if (len <= NSON_INLINE_SIZE) {
+		__nson_init_inline(nson, val, len, info);
+		return 0;
+	}
+	rv = nson_init(nson, info);
 	if (rv < 0)
 		return rv;
 
 	nson->d.buf = __nson_buf_wrap(val, len);
-	return rv;
+	return nson->d.buf ? rv : -1;
 }
 
 int
@@ -140,16 +282,14 @@ nson_init_str(Nson *nson, const char *val) {
 }
 
 int
-nson_load(NsonParser parser, Nson *nson, const char *file) {
+__nson_map_file(const char *file, char **buf, size_t *len, size_t *mapsize) {
 	struct stat st;
 	size_t pgsize = (size_t)sysconf(_SC_PAGESIZE);
-	size_t pgmask = pgsize - 1, mapsize;
+	size_t pgmask = pgsize - 1;
 	unsigned char *mf;
 	int need_guard = 0;
 	int fd;
-	memset(nson, 0, sizeof(*nson));
 
-	assert(nson);
 	assert(file);
 
 	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1)
@@ -163,8 +303,8 @@ nson_load(NsonParser parser, Nson *nson, const char *file) {
 		(void)close(fd);
 		return -1;
 	}
-	mapsize = ((size_t)st.st_size + 1 + pgmask) & ~pgmask;
-	if (mapsize < (size_t)st.st_size + 1) {
+	*mapsize = ((size_t)st.st_size + 1 + pgmask) & ~pgmask;
+	if (*mapsize < (size_t)st.st_size + 1) {
 		(void)close(fd);
 		return -1;
 	}
@@ -177,17 +317,33 @@ nson_load(NsonParser parser, Nson *nson, const char *file) {
 		need_guard = 1;
 
 	mf =
-			mmap(NULL, need_guard ? mapsize + pgsize : mapsize,
+			mmap(NULL, need_guard ? *mapsize + pgsize : *mapsize,
 				 PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 	(void)close(fd);
 	if (mf == MAP_FAILED) {
-		(void)munmap(mf, mapsize);
 		return -1;
 	}
 
-	int rv = parser(nson, (char *)mf, st.st_size);
+	*buf = (char *)mf;
+	*len = st.st_size;
+	return 0;
+}
+
+int
+nson_load(NsonParser parser, Nson *nson, const char *file) {
+	char *buf;
+	size_t len, mapsize;
+	memset(nson, 0, sizeof(*nson));
+
+	assert(nson);
+	assert(file);
+
+	if (__nson_map_file(file, &buf, &len, &mapsize) < 0)
+		return -1;
+
+	int rv = parser(nson, buf, len);
 
-	if (munmap(mf, mapsize) < 0) {
+	if (munmap(buf, mapsize) < 0) {
 		rv = -1;
 	}
 
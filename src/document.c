@@ -0,0 +1,170 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+typedef int (*NsonInsituParser)(Nson *, char *, size_t);
+
+typedef int (*NsonArenaParser)(Nson *, const char *, size_t, NsonArena *);
+
+static int
+doc_parse(
+		NsonInsituParser parser, NsonDocument *doc, char *buf, size_t len,
+		void (*dtor)(void *)) {
+	int rv;
+
+	memset(doc, 0, sizeof(*doc));
+	doc->buf = buf;
+	doc->len = len;
+	doc->dtor = dtor;
+
+	rv = parser(&doc->root, buf, len);
+	if (rv < 0) {
+		// On error the caller keeps the ownership of buf
+		nson_clean(&doc->root);
+		memset(doc, 0, sizeof(*doc));
+	}
+	return rv;
+}
+
+static int
+doc_load(NsonInsituParser parser, NsonDocument *doc, const char *file) {
+	int rv;
+	char *buf;
+	size_t len, mapsize;
+
+	memset(doc, 0, sizeof(*doc));
+	if (__nson_map_file(file, &buf, &len, &mapsize) < 0) {
+		return -1;
+	}
+
+	rv = doc_parse(parser, doc, buf, len, NULL);
+	if (rv >= 0) {
+		doc->mapsize = mapsize;
+	} else if (munmap(buf, mapsize) < 0) {
+		rv = -1;
+	}
+	return rv;
+}
+
+static int
+doc_parse_arena(
+		NsonArenaParser parser, NsonDocument *doc, const char *buf,
+		size_t len) {
+	int rv;
+
+	memset(doc, 0, sizeof(*doc));
+
+	rv = parser(&doc->root, buf, len, &doc->arena);
+	if (rv < 0) {
+		nson_doc_clean(doc);
+	}
+	return rv;
+}
+
+int
+nson_doc_parse_json(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *)) {
+	return doc_parse(__nson_parse_json_insitu, doc, buf, len, dtor);
+}
+
+int
+nson_doc_parse_plist(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *)) {
+	return doc_parse(__nson_parse_plist_insitu, doc, buf, len, dtor);
+}
+
+int
+nson_doc_parse_json_lazy(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *)) {
+	return doc_parse(__nson_parse_json_lazy, doc, buf, len, dtor);
+}
+
+int
+nson_doc_load_json(NsonDocument *doc, const char *file) {
+	return doc_load(__nson_parse_json_insitu, doc, file);
+}
+
+int
+nson_doc_load_json_lazy(NsonDocument *doc, const char *file) {
+	return doc_load(__nson_parse_json_lazy, doc, file);
+}
+
+int
+nson_doc_load_plist(NsonDocument *doc, const char *file) {
+	return doc_load(__nson_parse_plist_insitu, doc, file);
+}
+
+int
+nson_parse_json_arena(NsonDocument *doc, const char *buf, size_t len) {
+	return doc_parse_arena(__nson_parse_json_arena, doc, buf, len);
+}
+
+int
+nson_parse_plist_arena(NsonDocument *doc, const char *buf, size_t len) {
+	return doc_parse_arena(__nson_parse_plist_arena, doc, buf, len);
+}
+
+Nson *
+nson_doc_root(NsonDocument *doc) {
+	return &doc->root;
+}
+
+int
+nson_doc_clean(NsonDocument *doc) {
+	int rv = nson_clean(&doc->root);
+
+	if (doc->mapsize) {
+		if (munmap(doc->buf, doc->mapsize) < 0) {
+			rv = -1;
+		}
+	} else if (doc->dtor) {
+		doc->dtor(doc->buf);
+	}
+	__nson_arena_clean(&doc->arena);
+	memset(doc, 0, sizeof(*doc));
+
+	return rv;
+}
+
+void
+nson_parse_ctx_init(NsonParseContext *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void
+nson_parse_ctx_clean(NsonParseContext *ctx) {
+	__nson_builder_clean(&ctx->builder);
+	free(ctx->frames);
+	__nson_arena_clean(&ctx->arena);
+	memset(ctx, 0, sizeof(*ctx));
+}
@@ -0,0 +1,548 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NSON_ESCAPE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Serializers copy strings in runs of bytes that can be written as they
+ * are. __nson_escape_span() measures such a run, 16 or 32 bytes at a time
+ * where the CPU supports it. A byte needs to be escaped if it is a control
+ * character, one of three format specific characters or, in ASCII-only
+ * mode, not ASCII.
+ */
+
+typedef struct EscapeSet {
+	char special[3];
+	bool ascii;
+	bool table[256];
+} EscapeSet;
+
+#define CONTROL_CHARS [0 ... 0x1f] = true
+#define NON_ASCII_CHARS [0x80 ... 0xff] = true
+
+static const EscapeSet escape_sets[] = {
+		[NSON_ESCAPE_JSON] =
+				{
+						.special = {'"', '\\', '"'},
+						.table = {CONTROL_CHARS, ['"'] = true, ['\\'] = true},
+				},
+		[NSON_ESCAPE_JSON_ASCII] =
+				{
+						.special = {'"', '\\', '"'},
+						.ascii = true,
+						.table = {CONTROL_CHARS, NON_ASCII_CHARS, ['"'] = true,
+								  ['\\'] = true},
+				},
+		[NSON_ESCAPE_XML] =
+				{
+						.special = {'<', '>', '&'},
+						.table = {CONTROL_CHARS, ['<'] = true, ['>'] = true,
+								  ['&'] = true},
+				},
+};
+
+static size_t
+escape_span_scalar(const char *str, size_t len, const EscapeSet *set) {
+	size_t i;
+
+	for (i = 0; i < len && !set->table[(uint8_t)str[i]]; i++)
+		;
+	return i;
+}
+
+#ifdef NSON_ESCAPE_X86
+__attribute__((target("sse2"))) static size_t
+escape_span_sse2(const char *str, size_t len, const EscapeSet *set) {
+	size_t i;
+	uint32_t mask;
+	__m128i chunk, m;
+	const __m128i s0 = _mm_set1_epi8(set->special[0]);
+	const __m128i s1 = _mm_set1_epi8(set->special[1]);
+	const __m128i s2 = _mm_set1_epi8(set->special[2]);
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	const __m128i space = _mm_set1_epi8(0x20);
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		chunk = _mm_loadu_si128((const __m128i *)&str[i]);
+		if (set->ascii) {
+			// signed compare: matches control characters and bytes >= 0x80
+			m = _mm_cmplt_epi8(chunk, space);
+		} else {
+			m = _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl);
+		}
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, s0));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, s1));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, s2));
+		mask = _mm_movemask_epi8(m);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + escape_span_scalar(&str[i], len - i, set);
+}
+
+__attribute__((target("avx2"))) static size_t
+escape_span_avx2(const char *str, size_t len, const EscapeSet *set) {
+	size_t i;
+	uint32_t mask;
+	__m256i chunk, m;
+	const __m256i s0 = _mm256_set1_epi8(set->special[0]);
+	const __m256i s1 = _mm256_set1_epi8(set->special[1]);
+	const __m256i s2 = _mm256_set1_epi8(set->special[2]);
+	const __m256i ctrl = _mm256_set1_epi8(0x1f);
+	const __m256i space = _mm256_set1_epi8(0x20);
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		chunk = _mm256_loadu_si256((const __m256i *)&str[i]);
+		if (set->ascii) {
+			m = _mm256_cmpgt_epi8(space, chunk);
+		} else {
+			m = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, ctrl), ctrl);
+		}
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, s0));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, s1));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, s2));
+		mask = _mm256_movemask_epi8(m);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + escape_span_sse2(&str[i], len - i, set);
+}
+#endif
+
+size_t
+__nson_escape_span(const char *str, size_t len, enum NsonEscapeMode mode) {
+	const EscapeSet *set = &escape_sets[mode];
+
+#ifdef NSON_ESCAPE_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2")) {
+		return escape_span_avx2(str, len, set);
+	} else if (len >= 16 && __builtin_cpu_supports("sse2")) {
+		return escape_span_sse2(str, len, set);
+	}
+#endif
+	return escape_span_scalar(str, len, set);
+}
+
+size_t
+__nson_utf8_decode(uint32_t *chr, const char *str, size_t len) {
+	size_t i, n;
+	uint32_t c = (uint8_t)str[0];
+	uint32_t min;
+
+	if (c < 0x80) {
+		*chr = c;
+		return 1;
+	} else if ((c & 0xe0) == 0xc0) {
+		n = 2;
+		c &= 0x1f;
+		min = 0x80;
+	} else if ((c & 0xf0) == 0xe0) {
+		n = 3;
+		c &= 0x0f;
+		min = 0x800;
+	} else if ((c & 0xf8) == 0xf0) {
+		n = 4;
+		c &= 0x07;
+		min = 0x10000;
+	} else {
+		goto invalid;
+	}
+	if (n > len) {
+		goto invalid;
+	}
+	for (i = 1; i < n; i++) {
+		if ((str[i] & 0xc0) != 0x80) {
+			goto invalid;
+		}
+		c = (c << 6) | (str[i] & 0x3f);
+	}
+	// reject overlong encodings, surrogates and values beyond U+10FFFF
+	if (c < min || (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff) {
+		goto invalid;
+	}
+	*chr = c;
+	return n;
+invalid:
+	*chr = 0xfffd;
+	return 1;
+}
+
+static size_t
+ascii_span_scalar(const char *str, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len && (uint8_t)str[i] < 0x80; i++)
+		;
+	return i;
+}
+
+#ifdef NSON_ESCAPE_X86
+__attribute__((target("sse2"))) static size_t
+ascii_span_sse2(const char *str, size_t len) {
+	size_t i;
+	uint32_t mask;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&str[i]));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + ascii_span_scalar(&str[i], len - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+ascii_span_avx2(const char *str, size_t len) {
+	size_t i;
+	uint32_t mask;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		mask = _mm256_movemask_epi8(
+				_mm256_loadu_si256((const __m256i *)&str[i]));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + ascii_span_sse2(&str[i], len - i);
+}
+#endif
+
+static size_t
+ascii_span(const char *str, size_t len) {
+#ifdef NSON_ESCAPE_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2")) {
+		return ascii_span_avx2(str, len);
+	} else if (len >= 16 && __builtin_cpu_supports("sse2")) {
+		return ascii_span_sse2(str, len);
+	}
+#endif
+	return ascii_span_scalar(str, len);
+}
+
+/*
+ * Validates the sequences from the sequence boundary @p i on until one of
+ * them ends at or after @p stop. Runs of ASCII are skipped by the vector
+ * units.
+ *
+ * @return the end of the last sequence or the offset of an invalid one
+ */
+static size_t
+utf8_valid_scalar(const char *str, size_t len, size_t i, size_t stop) {
+	size_t n;
+	uint32_t chr;
+
+	while (i < stop) {
+		i += ascii_span(&str[i], len - i);
+		if (i == len) {
+			break;
+		}
+		n = __nson_utf8_decode(&chr, &str[i], len - i);
+		if (n == 1) {
+			// only a single byte decodes to U+FFFD on invalid input
+			return i;
+		}
+		i += n;
+	}
+	return i;
+}
+
+/*
+ * Returns the start of the sequence that covers @p i, provided that all
+ * sequences before it are valid.
+ */
+static size_t
+utf8_boundary(const char *str, size_t i) {
+	size_t k;
+
+	for (k = 1; k <= 3 && k <= i; k++) {
+		if (((uint8_t)str[i - k] & 0xc0) != 0x80) {
+			return i - k;
+		}
+	}
+	return i;
+}
+
+#ifdef NSON_ESCAPE_X86
+/*
+ * Multibyte sequences are checked 16 or 32 bytes at a time with the
+ * lookup tables of Keiser and Lemire, "Validating UTF-8 In Less Than One
+ * Instruction Per Byte". Every pair of adjacent bytes is classified by the
+ * high nibble of the first, its low nibble and the high nibble of the
+ * second byte. The bits that all three tables agree on are errors, except
+ * for TWO_CONTS, which is expected where a third or fourth byte of a
+ * sequence is due. The vector loop only detects errors, the scalar
+ * decoder locates them.
+ */
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const uint8_t utf8_byte_1_high[16] = {
+		// ASCII
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		UTF8_TOO_LONG,
+		// continuation
+		UTF8_TWO_CONTS,
+		UTF8_TWO_CONTS,
+		UTF8_TWO_CONTS,
+		UTF8_TWO_CONTS,
+		// 1100____, 1101____
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+		UTF8_TOO_SHORT,
+		// 1110____
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		// 1111____
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+				UTF8_OVERLONG_4,
+};
+
+static const uint8_t utf8_byte_1_low[16] = {
+		// ____0000, ____0001
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		UTF8_CARRY | UTF8_OVERLONG_2,
+		// ____001_
+		UTF8_CARRY,
+		UTF8_CARRY,
+		// ____0100, ____0101, ____011_
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		// ____1___, ____1101 is the lead of the surrogates
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const uint8_t utf8_byte_2_high[16] = {
+		// ASCII
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		// 1000____, 1001____, 101_____
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+				UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+				UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+				UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+				UTF8_TOO_LARGE,
+		// lead bytes
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT,
+};
+
+/* bytes at the end of a block that start a sequence it does not finish */
+static const uint8_t utf8_incomplete[16] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1,
+};
+
+__attribute__((target("ssse3"))) static __m128i
+utf8_errors_ssse3(__m128i input, __m128i prev_input) {
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+	const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+	const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+	__m128i special, must_continue;
+
+	special = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)utf8_byte_1_high),
+			_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+	special = _mm_and_si128(
+			special, _mm_shuffle_epi8(
+							 _mm_loadu_si128((const __m128i *)utf8_byte_1_low),
+							 _mm_and_si128(prev1, nibble)));
+	special = _mm_and_si128(
+			special,
+			_mm_shuffle_epi8(
+					_mm_loadu_si128((const __m128i *)utf8_byte_2_high),
+					_mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+	// third and fourth bytes of a sequence must be continuations
+	must_continue = _mm_or_si128(
+			_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+			_mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+	must_continue = _mm_and_si128(must_continue, _mm_set1_epi8(0x80));
+	return _mm_xor_si128(must_continue, special);
+}
+
+__attribute__((target("ssse3"))) static size_t
+utf8_valid_ssse3(const char *str, size_t len) {
+	size_t i = 0, j;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max = _mm_loadu_si128((const __m128i *)utf8_incomplete);
+	__m128i input, err, prev = zero, incomplete = zero;
+
+	while (i + 16 <= len) {
+		input = _mm_loadu_si128((const __m128i *)&str[i]);
+		if (_mm_movemask_epi8(input) == 0) {
+			// ASCII is only invalid after an unfinished sequence
+			err = incomplete;
+			incomplete = zero;
+		} else {
+			err = utf8_errors_ssse3(input, prev);
+			incomplete = _mm_subs_epu8(input, max);
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, zero)) == 0xffff) {
+			prev = input;
+			i += 16;
+			continue;
+		}
+		j = utf8_valid_scalar(str, len, utf8_boundary(str, i), i + 16);
+		if (j < i + 16) {
+			return j;
+		}
+		// j is a sequence boundary, so the block before it is not needed
+		i = j;
+		prev = incomplete = zero;
+	}
+	return utf8_valid_scalar(str, len, utf8_boundary(str, i), len);
+}
+
+__attribute__((target("avx2"))) static __m256i
+utf8_lookup_avx2(const uint8_t *table, __m256i index) {
+	return _mm256_shuffle_epi8(
+			_mm256_broadcastsi128_si256(
+					_mm_loadu_si128((const __m128i *)table)),
+			index);
+}
+
+__attribute__((target("avx2"))) static __m256i
+utf8_errors_avx2(__m256i input, __m256i prev_input) {
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	// the bytes in front of each lane
+	const __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+	const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+	const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+	const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+	__m256i special, must_continue;
+
+	special = utf8_lookup_avx2(
+			utf8_byte_1_high,
+			_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+	special = _mm256_and_si256(
+			special, utf8_lookup_avx2(
+							 utf8_byte_1_low, _mm256_and_si256(prev1, nibble)));
+	special = _mm256_and_si256(
+			special,
+			utf8_lookup_avx2(
+					utf8_byte_2_high,
+					_mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+	must_continue = _mm256_or_si256(
+			_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+			_mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+	must_continue = _mm256_and_si256(must_continue, _mm256_set1_epi8(0x80));
+	return _mm256_xor_si256(must_continue, special);
+}
+
+__attribute__((target("avx2"))) static size_t
+utf8_valid_avx2(const char *str, size_t len) {
+	size_t i = 0, j;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_setr_m128i(
+			_mm_set1_epi8((char)0xff),
+			_mm_loadu_si128((const __m128i *)utf8_incomplete));
+	__m256i input, err, prev = zero, incomplete = zero;
+
+	while (i + 32 <= len) {
+		input = _mm256_loadu_si256((const __m256i *)&str[i]);
+		if (_mm256_movemask_epi8(input) == 0) {
+			err = incomplete;
+			incomplete = zero;
+		} else {
+			err = utf8_errors_avx2(input, prev);
+			incomplete = _mm256_subs_epu8(input, max);
+		}
+		if (_mm256_testz_si256(err, err)) {
+			prev = input;
+			i += 32;
+			continue;
+		}
+		j = utf8_valid_scalar(str, len, utf8_boundary(str, i), i + 32);
+		if (j < i + 32) {
+			return j;
+		}
+		i = j;
+		prev = incomplete = zero;
+	}
+	return utf8_valid_scalar(str, len, utf8_boundary(str, i), len);
+}
+#endif
+
+/*
+ * Returns the length of the valid UTF-8 prefix of @p str.
+ */
+size_t
+__nson_utf8_valid(const char *str, size_t len) {
+#ifdef NSON_ESCAPE_X86
+	if (len >= 32 && __builtin_cpu_supports("avx2")) {
+		return utf8_valid_avx2(str, len);
+	} else if (len >= 16 && __builtin_cpu_supports("ssse3")) {
+		return utf8_valid_ssse3(str, len);
+	}
+#endif
+	return utf8_valid_scalar(str, len, 0, len);
+}
@@ -0,0 +1,445 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Number formatting shared by the serializers. Integers are written two
+ * digits at a time from a lookup table. Reals are written with Florian
+ * Loitsch's Grisu2 algorithm. Its output always parses back to the same
+ * double and is usually the shortest such digit sequence, but about one
+ * in a thousand values gets a digit more than necessary.
+ */
+
+static const char digit_pairs[] = "00010203040506070809"
+								  "10111213141516171819"
+								  "20212223242526272829"
+								  "30313233343536373839"
+								  "40414243444546474849"
+								  "50515253545556575859"
+								  "60616263646566676869"
+								  "70717273747576777879"
+								  "80818283848586878889"
+								  "90919293949596979899";
+
+static const uint64_t pow10_table[] = {
+		UINT64_C(1),
+		UINT64_C(10),
+		UINT64_C(100),
+		UINT64_C(1000),
+		UINT64_C(10000),
+		UINT64_C(100000),
+		UINT64_C(1000000),
+		UINT64_C(10000000),
+		UINT64_C(100000000),
+		UINT64_C(1000000000),
+		UINT64_C(10000000000),
+		UINT64_C(100000000000),
+		UINT64_C(1000000000000),
+		UINT64_C(10000000000000),
+		UINT64_C(100000000000000),
+		UINT64_C(1000000000000000),
+		UINT64_C(10000000000000000),
+		UINT64_C(100000000000000000),
+		UINT64_C(1000000000000000000),
+		UINT64_C(10000000000000000000),
+};
+
+/* normalized 64 bit approximations of 10^-348, 10^-340, ..., 10^340 */
+static const struct {
+	uint64_t f;
+	int e;
+} cached_pow10[] = {
+	{0xfa8fd5a0081c0288u, -1220}, /* 10^-348 */
+	{0xbaaee17fa23ebf76u, -1193}, /* 10^-340 */
+	{0x8b16fb203055ac76u, -1166}, /* 10^-332 */
+	{0xcf42894a5dce35eau, -1140}, /* 10^-324 */
+	{0x9a6bb0aa55653b2du, -1113}, /* 10^-316 */
+	{0xe61acf033d1a45dfu, -1087}, /* 10^-308 */
+	{0xab70fe17c79ac6cau, -1060}, /* 10^-300 */
+	{0xff77b1fcbebcdc4fu, -1034}, /* 10^-292 */
+	{0xbe5691ef416bd60cu, -1007}, /* 10^-284 */
+	{0x8dd01fad907ffc3cu, -980}, /* 10^-276 */
+	{0xd3515c2831559a83u, -954}, /* 10^-268 */
+	{0x9d71ac8fada6c9b5u, -927}, /* 10^-260 */
+	{0xea9c227723ee8bcbu, -901}, /* 10^-252 */
+	{0xaecc49914078536du, -874}, /* 10^-244 */
+	{0x823c12795db6ce57u, -847}, /* 10^-236 */
+	{0xc21094364dfb5637u, -821}, /* 10^-228 */
+	{0x9096ea6f3848984fu, -794}, /* 10^-220 */
+	{0xd77485cb25823ac7u, -768}, /* 10^-212 */
+	{0xa086cfcd97bf97f4u, -741}, /* 10^-204 */
+	{0xef340a98172aace5u, -715}, /* 10^-196 */
+	{0xb23867fb2a35b28eu, -688}, /* 10^-188 */
+	{0x84c8d4dfd2c63f3bu, -661}, /* 10^-180 */
+	{0xc5dd44271ad3cdbau, -635}, /* 10^-172 */
+	{0x936b9fcebb25c996u, -608}, /* 10^-164 */
+	{0xdbac6c247d62a584u, -582}, /* 10^-156 */
+	{0xa3ab66580d5fdaf6u, -555}, /* 10^-148 */
+	{0xf3e2f893dec3f126u, -529}, /* 10^-140 */
+	{0xb5b5ada8aaff80b8u, -502}, /* 10^-132 */
+	{0x87625f056c7c4a8bu, -475}, /* 10^-124 */
+	{0xc9bcff6034c13053u, -449}, /* 10^-116 */
+	{0x964e858c91ba2655u, -422}, /* 10^-108 */
+	{0xdff9772470297ebdu, -396}, /* 10^-100 */
+	{0xa6dfbd9fb8e5b88fu, -369}, /* 10^-92 */
+	{0xf8a95fcf88747d94u, -343}, /* 10^-84 */
+	{0xb94470938fa89bcfu, -316}, /* 10^-76 */
+	{0x8a08f0f8bf0f156bu, -289}, /* 10^-68 */
+	{0xcdb02555653131b6u, -263}, /* 10^-60 */
+	{0x993fe2c6d07b7facu, -236}, /* 10^-52 */
+	{0xe45c10c42a2b3b06u, -210}, /* 10^-44 */
+	{0xaa242499697392d3u, -183}, /* 10^-36 */
+	{0xfd87b5f28300ca0eu, -157}, /* 10^-28 */
+	{0xbce5086492111aebu, -130}, /* 10^-20 */
+	{0x8cbccc096f5088ccu, -103}, /* 10^-12 */
+	{0xd1b71758e219652cu, -77}, /* 10^-4 */
+	{0x9c40000000000000u, -50}, /* 10^4 */
+	{0xe8d4a51000000000u, -24}, /* 10^12 */
+	{0xad78ebc5ac620000u, 3}, /* 10^20 */
+	{0x813f3978f8940984u, 30}, /* 10^28 */
+	{0xc097ce7bc90715b3u, 56}, /* 10^36 */
+	{0x8f7e32ce7bea5c70u, 83}, /* 10^44 */
+	{0xd5d238a4abe98068u, 109}, /* 10^52 */
+	{0x9f4f2726179a2245u, 136}, /* 10^60 */
+	{0xed63a231d4c4fb27u, 162}, /* 10^68 */
+	{0xb0de65388cc8ada8u, 189}, /* 10^76 */
+	{0x83c7088e1aab65dbu, 216}, /* 10^84 */
+	{0xc45d1df942711d9au, 242}, /* 10^92 */
+	{0x924d692ca61be758u, 269}, /* 10^100 */
+	{0xda01ee641a708deau, 295}, /* 10^108 */
+	{0xa26da3999aef774au, 322}, /* 10^116 */
+	{0xf209787bb47d6b85u, 348}, /* 10^124 */
+	{0xb454e4a179dd1877u, 375}, /* 10^132 */
+	{0x865b86925b9bc5c2u, 402}, /* 10^140 */
+	{0xc83553c5c8965d3du, 428}, /* 10^148 */
+	{0x952ab45cfa97a0b3u, 455}, /* 10^156 */
+	{0xde469fbd99a05fe3u, 481}, /* 10^164 */
+	{0xa59bc234db398c25u, 508}, /* 10^172 */
+	{0xf6c69a72a3989f5cu, 534}, /* 10^180 */
+	{0xb7dcbf5354e9beceu, 561}, /* 10^188 */
+	{0x88fcf317f22241e2u, 588}, /* 10^196 */
+	{0xcc20ce9bd35c78a5u, 614}, /* 10^204 */
+	{0x98165af37b2153dfu, 641}, /* 10^212 */
+	{0xe2a0b5dc971f303au, 667}, /* 10^220 */
+	{0xa8d9d1535ce3b396u, 694}, /* 10^228 */
+	{0xfb9b7cd9a4a7443cu, 720}, /* 10^236 */
+	{0xbb764c4ca7a44410u, 747}, /* 10^244 */
+	{0x8bab8eefb6409c1au, 774}, /* 10^252 */
+	{0xd01fef10a657842cu, 800}, /* 10^260 */
+	{0x9b10a4e5e9913129u, 827}, /* 10^268 */
+	{0xe7109bfba19c0c9du, 853}, /* 10^276 */
+	{0xac2820d9623bf429u, 880}, /* 10^284 */
+	{0x80444b5e7aa7cf85u, 907}, /* 10^292 */
+	{0xbf21e44003acdd2du, 933}, /* 10^300 */
+	{0x8e679c2f5e44ff8fu, 960}, /* 10^308 */
+	{0xd433179d9c8cb841u, 986}, /* 10^316 */
+	{0x9e19db92b4e31ba9u, 1013}, /* 10^324 */
+	{0xeb96bf6ebadf77d9u, 1039}, /* 10^332 */
+	{0xaf87023b9bf0ee6bu, 1066}, /* 10^340 */
+};
+
+typedef struct {
+	uint64_t f;
+	int e;
+} DiyFp;
+
+#define SIGNIFICAND_BITS 52
+#define HIDDEN_BIT (UINT64_C(1) << SIGNIFICAND_BITS)
+
+static size_t
+format_uint(char *buf, uint64_t val) {
+	char tmp[20];
+	char *p = &tmp[sizeof(tmp)];
+	size_t len;
+
+	while (val >= 100) {
+		p -= 2;
+		memcpy(p, &digit_pairs[(val % 100) * 2], 2);
+		val /= 100;
+	}
+	if (val >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[val * 2], 2);
+	} else {
+		*--p = '0' + val;
+	}
+
+	len = &tmp[sizeof(tmp)] - p;
+	memcpy(buf, p, len);
+	return len;
+}
+
+size_t
+__nson_format_int(char *buf, int64_t val) {
+	if (val < 0) {
+		*buf = '-';
+		return format_uint(&buf[1], -(uint64_t)val) + 1;
+	}
+	return format_uint(buf, val);
+}
+
+static DiyFp
+diy_mul(DiyFp x, DiyFp y) {
+	DiyFp r;
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)x.f * y.f;
+
+	r.f = p >> 64;
+	// round the lower half
+	r.f += (uint64_t)p >> 63;
+#else
+	const uint64_t m32 = 0xFFFFFFFF;
+	uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+
+	tmp += 1U << 31;
+	r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+#endif
+	r.e = x.e + y.e + 64;
+	return r;
+}
+
+static DiyFp
+diy_normalize(DiyFp x) {
+	int shift = __builtin_clzll(x.f);
+
+	x.f <<= shift;
+	x.e -= shift;
+	return x;
+}
+
+static void
+diy_boundaries(DiyFp v, DiyFp *minus, DiyFp *plus) {
+	DiyFp p = {(v.f << 1) + 1, v.e - 1};
+
+	p = diy_normalize(p);
+	if (v.f == HIDDEN_BIT) {
+		minus->f = (v.f << 2) - 1;
+		minus->e = v.e - 2;
+	} else {
+		minus->f = (v.f << 1) - 1;
+		minus->e = v.e - 1;
+	}
+	minus->f <<= minus->e - p.e;
+	minus->e = p.e;
+	*plus = p;
+}
+
+static int
+count_digits(uint32_t n) {
+	int i;
+
+	for (i = 1; i < 10 && n >= pow10_table[i]; i++)
+		;
+	return i;
+}
+
+static void
+grisu_round(
+		char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+		uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+		   (rest + ten_kappa < wp_w ||
+			wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int
+digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char *buf, int *k) {
+	const DiyFp one = {UINT64_C(1) << -mp.e, mp.e};
+	const uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = mp.f >> -one.e;
+	uint64_t p2 = mp.f & (one.f - 1);
+	uint64_t rest;
+	int kappa = count_digits(p1);
+	int len = 0;
+	uint32_t d;
+
+	while (kappa > 0) {
+		d = p1 / pow10_table[kappa - 1];
+		p1 %= pow10_table[kappa - 1];
+		if (d || len) {
+			buf[len++] = '0' + d;
+		}
+		kappa--;
+		rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(
+					buf, len, delta, rest, pow10_table[kappa] << -one.e,
+					wp_w);
+			return len;
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		d = p2 >> -one.e;
+		if (d || len) {
+			buf[len++] = '0' + d;
+		}
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			grisu_round(
+					buf, len, delta, p2, one.f,
+					wp_w * (-kappa < 20 ? pow10_table[-kappa] : 0));
+			return len;
+		}
+	}
+}
+
+static int
+grisu2(double val, char *buf, int *k) {
+	uint64_t bits;
+	int biased_e, index;
+	double dk;
+	DiyFp v, w, minus, plus, c;
+
+	memcpy(&bits, &val, sizeof(bits));
+	biased_e = (bits >> SIGNIFICAND_BITS) & 0x7FF;
+	v.f = bits & (HIDDEN_BIT - 1);
+	if (biased_e) {
+		v.f += HIDDEN_BIT;
+		v.e = biased_e - 1075;
+	} else {
+		v.e = -1074;
+	}
+
+	diy_boundaries(v, &minus, &plus);
+
+	// find a cached power of ten that scales plus into [2^-60, 2^-32]
+	dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+	index = (int)dk;
+	if (dk - index > 0.0) {
+		index++;
+	}
+	index = (index >> 3) + 1;
+	*k = -(-348 + index * 8);
+	c.f = cached_pow10[index].f;
+	c.e = cached_pow10[index].e;
+
+	w = diy_mul(diy_normalize(v), c);
+	plus = diy_mul(plus, c);
+	minus = diy_mul(minus, c);
+	minus.f++;
+	plus.f--;
+
+	return digit_gen(w, plus, plus.f - minus.f, buf, k);
+}
+
+static size_t
+write_exponent(char *buf, int k) {
+	size_t len = 0;
+
+	if (k < 0) {
+		buf[len++] = '-';
+		k = -k;
+	}
+	return len + format_uint(&buf[len], k);
+}
+
+/*
+ * Formats the digits in buf, representing digits * 10^k, so that the
+ * result reads back as a real.
+ */
+static size_t
+prettify(char *buf, int len, int k) {
+	int i, offset;
+	const int kk = len + k;
+
+	if (k >= 0 && kk <= 21) {
+		// 1234e7 -> 12340000000.0
+		for (i = len; i < kk; i++) {
+			buf[i] = '0';
+		}
+		buf[kk] = '.';
+		buf[kk + 1] = '0';
+		return kk + 2;
+	} else if (kk > 0 && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(&buf[kk + 1], &buf[kk], len - kk);
+		buf[kk] = '.';
+		return len + 1;
+	} else if (kk > -6 && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		offset = 2 - kk;
+		memmove(&buf[offset], buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		for (i = 2; i < offset; i++) {
+			buf[i] = '0';
+		}
+		return len + offset;
+	} else if (len == 1) {
+		// 1e30
+		buf[1] = 'e';
+		return 2 + write_exponent(&buf[2], kk - 1);
+	} else {
+		// 1234e30 -> 1.234e33
+		memmove(&buf[2], &buf[1], len - 1);
+		buf[1] = '.';
+		buf[len + 1] = 'e';
+		return len + 2 + write_exponent(&buf[len + 2], kk - 1);
+	}
+}
+
+size_t
+__nson_format_real(char *buf, double val) {
+	int len, k;
+	size_t sign = 0;
+
+	if (isnan(val)) {
+		memcpy(buf, "nan", 3);
+		return 3;
+	}
+	if (signbit(val)) {
+		buf[sign++] = '-';
+		val = -val;
+	}
+	if (isinf(val)) {
+		memcpy(&buf[sign], "inf", 3);
+		return sign + 3;
+	} else if (val == 0) {
+		memcpy(&buf[sign], "0.0", 3);
+		return sign + 3;
+	}
+
+	len = grisu2(val, &buf[sign], &k);
+	return sign + prettify(&buf[sign], len, k);
+}
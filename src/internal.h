@@ -38,6 +38,8 @@
 
 typedef struct NsonBuf {
 	unsigned int count;
+	/* buf still contains JSON escape sequences, see nson_data() */
+	bool escaped;
 	size_t siz;
 	/* ISO C forbids zero-size array. So use 1 here and use the additional byte
 	 * for zero termination. */
@@ -60,8 +62,73 @@ typedef struct NsonStack {
 	size_t len;
 } NsonStack;
 
+/* large enough for any number written by __nson_format_*() */
+#define NSON_FORMAT_SIZE 32
+
+enum NsonEscapeMode {
+	NSON_ESCAPE_JSON,
+	NSON_ESCAPE_JSON_ASCII,
+	NSON_ESCAPE_XML,
+};
+
+enum NsonFlags {
+	/* the storage of the container is owned by an NsonArena */
+	NSON_FLAG_ARENA = 1 << 0,
+	/* the container has not been read from its source yet */
+	NSON_FLAG_LAZY = 1 << 1,
+	/* the string is stored in NsonInline */
+	NSON_FLAG_INLINE = 1 << 2,
+	/* the data is borrowed from the source of an NsonDocument */
+	NSON_FLAG_BORROWED = 1 << 3,
+	/* the borrowed data still contains JSON escape sequences */
+	NSON_FLAG_ESCAPED = 1 << 4,
+};
+
+/*
+ * Storage of arrays and objects starts with this header. The Nson itself
+ * only points to the elements that follow it.
+ */
+typedef struct NsonContainerMem {
+	size_t cap;
+	/* lookup index of larger objects, see object.c */
+	struct NsonObjectIndex *index;
+} NsonContainerMem;
+
+#define NSON_MEM(elements) ((NsonContainerMem *)(elements)-1)
+
+#define NSON_LAZY_LOAD(nson) \
+	((nson)->c.flags & NSON_FLAG_LAZY ? __nson_lazy_load((Nson *)(nson)) : 0)
+
+#define NSON_SCAN_BLOCK 64
+#define NSON_SCAN_WINDOW 16
+
+typedef struct NsonScanMasks {
+	uint64_t space;
+	uint64_t op;
+	uint64_t quote;
+	uint64_t backslash;
+} NsonScanMasks;
+
+typedef void (*NsonScanClassifier)(const char *block, NsonScanMasks *masks);
+
+typedef struct NsonScanner {
+	const char *doc;
+	size_t len;
+	size_t offset;
+	NsonScanClassifier classify;
+	/* state carried over from the previous block */
+	uint64_t in_string;
+	uint64_t escaped;
+	uint64_t scalar;
+	size_t index_len;
+	size_t index_pos;
+	/* must be the last member, see __nson_scan_init() */
+	size_t index[NSON_SCAN_BLOCK * NSON_SCAN_WINDOW];
+} NsonScanner;
+
 typedef struct NsonSerializerInfo {
-	int (*serializer)(FILE *out, const Nson *object, enum NsonOptions options);
+	int (*serializer)(
+			NsonWriter *out, const Nson *object, enum NsonOptions options);
 	char *seperator;
 
 	char *key_value_seperator;
@@ -75,14 +142,80 @@ int stack_pop(NsonStack *stack, Nson **element, off_t *index);
 
 void stack_clean(NsonStack *stack);
 
+NsonScanClassifier __nson_scan_classifier(void);
+
+void __nson_scan_init(NsonScanner *scan, const char *doc, size_t len);
+
+off_t __nson_scan_next(NsonScanner *scan);
+
+void *__nson_arena_alloc(NsonArena *arena, size_t size);
+
+char *__nson_arena_strndup(NsonArena *arena, const char *src, size_t len);
+
+void __nson_arena_reset(NsonArena *arena);
+
+void __nson_arena_clean(NsonArena *arena);
+
+int __nson_builder_push(NsonBuilder *builder, Nson *value);
+
+int __nson_builder_open(NsonBuilder *builder, enum NsonType type);
+
+int __nson_builder_close(NsonBuilder *builder, enum NsonType type);
+
+int __nson_builder_finish(NsonBuilder *builder, Nson *nson);
+
+void __nson_builder_reset(NsonBuilder *builder);
+
+void __nson_builder_clean(NsonBuilder *builder);
+
 off_t __nson_parse_dev(int64_t *i, const char *p, size_t len);
 
 off_t __nson_parse_hex(uint64_t *dest, const char *src, size_t len);
 
 off_t __nson_parse_b64(NsonBuf **dest_buf, const char *src, const size_t len);
 
+size_t __nson_format_b64(char *dest, const char *src, size_t len);
+
+uint64_t __nson_hash(const char *data, size_t len);
+
 off_t __nson_parse_number(Nson *nson, const char *p, size_t len);
 
+int __nson_writer_init_mem(NsonWriter *writer);
+
+int __nson_writer_init_cb(
+		NsonWriter *writer, NsonWriterSink sink, void *user_data);
+
+int __nson_writer_init_file(NsonWriter *writer, FILE *file);
+
+int __nson_writer_init_fd(NsonWriter *writer, int fd);
+
+char *__nson_writer_reserve(NsonWriter *writer, size_t len);
+
+int __nson_writer_write(NsonWriter *writer, const char *data, size_t len);
+
+int __nson_writer_write_b64(NsonWriter *writer, const char *data, size_t len);
+
+int __nson_writer_puts(NsonWriter *writer, const char *str);
+
+int __nson_writer_putc(NsonWriter *writer, char c);
+
+int __nson_writer_flush(NsonWriter *writer);
+
+int __nson_writer_finish(NsonWriter *writer);
+
+int __nson_writer_take(NsonWriter *writer, char **str, size_t *size);
+
+size_t __nson_escape_span(
+		const char *str, size_t len, enum NsonEscapeMode mode);
+
+size_t __nson_utf8_decode(uint32_t *chr, const char *str, size_t len);
+
+size_t __nson_utf8_valid(const char *str, size_t len);
+
+size_t __nson_format_int(char *buf, int64_t val);
+
+size_t __nson_format_real(char *buf, double val);
+
 off_t __nson_to_utf8(char *dest, const uint64_t chr, const size_t len);
 
 char *__nson_buf(NsonBuf *buf);
@@ -101,24 +234,93 @@ int __nson_buf_shrink(NsonBuf *buf, size_t new_siz);
 
 void __nson_buf_release(NsonBuf *buf);
 
-int __nson_buf_cmp(const NsonBuf *a, const NsonBuf *b);
-
 int __nson_init_buf(Nson *nson, NsonBuf *val, enum NsonType info);
 
+int __nson_init_ref(Nson *nson, const char *val, size_t len, enum NsonType info);
+
+char *__nson_init_inline(
+		Nson *nson, const char *val, size_t len, enum NsonType info);
+
+void __nson_inline_set_len(Nson *nson, size_t len);
+
+int __nson_data_cmp(const Nson *a, const Nson *b);
+
+int __nson_data_replace(Nson *nson, NsonBuf *buf);
+
+int __nson_map_file(const char *file, char **buf, size_t *len, size_t *mapsize);
+
+int __nson_parse_json_insitu(Nson *nson, char *doc, size_t len);
+
+int __nson_parse_json_string(Nson *nson, const char *src, size_t len);
+
+int __nson_parse_json_string_insitu(Nson *nson, char *src, size_t len);
+
+off_t __nson_json_string_end(const char *doc, size_t len, size_t i);
+
+off_t __nson_json_value_end(const char *doc, size_t len, size_t i);
+
+int __nson_parse_json_scalar(Nson *nson, const char *src, size_t len);
+
+bool __nson_json_delimiter(char c);
+
+int __nson_parse_json_arena(
+		Nson *nson, const char *doc, size_t len, NsonArena *arena);
+
+int __nson_parse_json_elements(Nson *array, const char *doc, size_t len);
+
+int __nson_parse_json_lazy(Nson *nson, char *doc, size_t len);
+
+int __nson_lazy_load(Nson *nson);
+
+int __nson_lazy_copy(Nson *nson);
+
+int __nson_json_write(
+		NsonWriter *out, const Nson *nson, enum NsonOptions options);
+
+int __nson_json_write_string(
+		NsonWriter *out, const char *data, size_t len,
+		enum NsonOptions options);
+
+int __nson_json_write_int(NsonWriter *out, int64_t value);
+
+int __nson_json_write_real(NsonWriter *out, double value);
+
+size_t __nson_json_unescape(char *dest, const char *src, const size_t len);
+
+int __nson_parse_plist_insitu(Nson *nson, char *doc, size_t len);
+
+int __nson_parse_plist_arena(
+		Nson *nson, const char *doc, size_t len, NsonArena *arena);
+
+void *__nson_mem_resize(void *elements, size_t cap, size_t size);
+
+void *__nson_mem_arena(NsonArena *arena, size_t cap, size_t size);
+
+void __nson_mem_free(void *elements);
+
 int __nson_arr_clone(Nson *array);
 
+int __nson_arr_init_move(
+		Nson *array, Nson *values, size_t len, NsonArena *arena);
+
 int __nson_obj_clone(Nson *object);
 
+int __nson_obj_index_arena(Nson *object, NsonArena *arena);
+
 NsonObjectEntry *__nson_obj_get_entry(const Nson *object, int index);
 
 int __nson_obj_serialize(
-		FILE *out, const Nson *object, const NsonSerializerInfo *info,
+		NsonWriter *out, const Nson *object, const NsonSerializerInfo *info,
 		enum NsonOptions options);
 
 int __nson_arr_serialize(
-		FILE *out, const Nson *array, const NsonSerializerInfo *info,
+		NsonWriter *out, const Nson *array, const NsonSerializerInfo *info,
 		enum NsonOptions options);
 
+int __nson_arr_shrink(Nson *array);
+
+int __nson_obj_shrink(Nson *object);
+
 int __nson_arr_clean(Nson *nson);
 
 int __nson_obj_clean(Nson *nson);
@@ -32,40 +32,116 @@
 
 #include <assert.h>
 #include <ctype.h>
-#include <inttypes.h>
+#include <math.h>
 #include <search.h>
 #include <string.h>
 
-static int
-json_str_len(const char *src, const size_t len) {
-	const char *chunk = src;
+bool
+__nson_json_delimiter(char c) {
+	switch (c) {
+	case ',':
+	case ':':
+	case '[':
+	case ']':
+	case '{':
+	case '}':
+	case '"':
+	case '\n':
+	case '\f':
+	case '\r':
+	case '\t':
+	case '\v':
+	case ' ':
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+json_scalar_end(const char *doc, const size_t len, const off_t i) {
+	return i >= len || __nson_json_delimiter(doc[i]);
+}
 
-	for (; (chunk = memchr(chunk, '"', len - (chunk - src))); chunk++) {
-		if (chunk[-1] != '\\' || chunk[-2] == '\\') {
+/*
+ * Returns the offset of the quote that closes the string opened at @p i
+ * or -1 if the string is not terminated.
+ */
+off_t
+__nson_json_string_end(const char *doc, size_t len, size_t i) {
+	for (i++; i < len; i++) {
+		i += __nson_escape_span(&doc[i], len - i, NSON_ESCAPE_JSON);
+		if (i >= len) {
 			break;
+		} else if (doc[i] == '"') {
+			return i;
+		} else if (doc[i] == '\\') {
+			i++;
 		}
 	}
-	if (chunk == NULL) {
-		return -1;
+	return -1;
+}
+
+/*
+ * Returns the end of the value at @p i without parsing it. Containers are
+ * skipped by matching their brackets, their content is not validated.
+ */
+off_t
+__nson_json_value_end(const char *doc, size_t len, size_t i) {
+	off_t end;
+	size_t depth = 0;
+	const char open = doc[i];
+
+	if (open == '"') {
+		end = __nson_json_string_end(doc, len, i);
+		return end < 0 ? -1 : end + 1;
+	} else if (open != '[' && open != '{') {
+		for (end = i; end < len && !__nson_json_delimiter(doc[end]); end++)
+			;
+		return end == i ? -1 : end;
+	}
+
+	for (; i < len; i++) {
+		switch (doc[i]) {
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case ']':
+		case '}':
+			if (--depth > 0) {
+				break;
+			}
+			return (open == '[') == (doc[i] == ']') ? (off_t)i + 1 : -1;
+		case '"':
+			end = __nson_json_string_end(doc, len, i);
+			if (end < 0) {
+				return -1;
+			}
+			i = end;
+			break;
+		}
 	}
-	return chunk - src;
+	return -1;
 }
 
-static int
-parse_json_string(NsonBuf **dest_buf, const char *src, const size_t len) {
+/*
+ * Decodes the escape sequences of the JSON string @p src into @p dest.
+ * The decoded string is never longer than its source, so @p dest may be
+ * the same as @p src.
+ */
+size_t
+__nson_json_unescape(char *dest, const char *src, const size_t len) {
 	const char *chunk_start, *chunk_end;
 	size_t chunk_len;
-	char *dest;
-	uint64_t utf_val;
-
-	(*dest_buf) = __nson_buf_new(len);
-	dest = __nson_buf(*dest_buf);
+	char *dest_start = dest;
+	uint64_t utf_val, low_val;
 
 	for (chunk_start = src;
 		 (chunk_end = memchr(chunk_start, '\\', len - (chunk_start - src)));) {
 		chunk_len = chunk_end - chunk_start;
 
-		memcpy(dest, chunk_start, chunk_len);
+		memmove(dest, chunk_start, chunk_len);
 		dest += chunk_len;
 		chunk_start = chunk_end + 1;
 
@@ -79,13 +155,28 @@ parse_json_string(NsonBuf **dest_buf, const char *src, const size_t len) {
 			if (__nson_parse_hex(&utf_val, &chunk_start[1], 4) != 4) {
 				break;
 			}
-			// TODO: correctly supply upper bounds.
-			dest += __nson_to_utf8(dest, utf_val, 3);
 			chunk_start += 5;
+			// combine UTF-16 surrogate pairs
+			if (utf_val >= 0xd800 && utf_val <= 0xdbff &&
+				src + len - chunk_start >= 6 && chunk_start[0] == '\\' &&
+				chunk_start[1] == 'u' &&
+				__nson_parse_hex(&low_val, &chunk_start[2], 4) == 4 &&
+				low_val >= 0xdc00 && low_val <= 0xdfff) {
+				utf_val = 0x10000 + ((utf_val - 0xd800) << 10) +
+						(low_val - 0xdc00);
+				chunk_start += 6;
+			}
+			dest += __nson_to_utf8(dest, utf_val, 4);
 			continue;
 		}
 
 		switch (chunk_start[0]) {
+		case 'b':
+			*dest = '\b';
+			break;
+		case 'f':
+			*dest = '\f';
+			break;
 		case 't':
 			*dest = '\t';
 			break;
@@ -106,77 +197,160 @@ parse_json_string(NsonBuf **dest_buf, const char *src, const size_t len) {
 		chunk_start += 1;
 	}
 	chunk_len = src + len - chunk_start;
-	memcpy(dest, chunk_start, chunk_len);
+	memmove(dest, chunk_start, chunk_len);
 	dest += chunk_len;
-	__nson_buf_shrink(*dest_buf, dest - __nson_buf(*dest_buf));
 
-	return dest - __nson_buf(*dest_buf);
+	return dest - dest_start;
 }
 
-static int
-json_escape_string(const Nson *nson, FILE *fd) {
-	int rv = 0;
-	off_t i = 0, last_write = 0;
-	char c[] = {'\\', 0};
-	const char *data;
-	size_t len;
+int
+__nson_parse_json_string(Nson *nson, const char *src, size_t len) {
+	char *str;
+	NsonBuf *buf;
+
+	if (len <= NSON_INLINE_SIZE) {
+		// Decoding never makes a string longer
+		str = __nson_init_inline(nson, NULL, len, NSON_STR);
+		__nson_inline_set_len(nson, __nson_json_unescape(str, src, len));
+		return len;
+	}
 
-	if (fputc('"', fd) < 0) {
+	buf = __nson_buf_wrap(src, len);
+	if (buf == NULL) {
 		return -1;
 	}
+	// Escape sequences are decoded on first access, see nson_data()
+	buf->escaped = memchr(src, '\\', len) != NULL;
+	__nson_init_buf(nson, buf, NSON_STR);
+	__nson_buf_release(buf);
 
-	data = nson_data(nson);
-	len = nson_data_len(nson);
+	return len;
+}
 
-	for (; i < len; i++) {
-		switch (data[i]) {
-		case '\t':
-			c[1] = 't';
-			break;
-		case '\n':
-			c[1] = 'n';
-			break;
-		case '\r':
-			c[1] = 'r';
-			break;
-		case '"':
-			c[1] = '"';
+/*
+ * Parses the number or literal that spans exactly @p len bytes of @p src.
+ */
+int
+__nson_parse_json_scalar(Nson *nson, const char *src, size_t len) {
+	switch (src[0]) {
+	case 'n':
+		if (len != 4 || memcmp(src, "null", 4)) {
+			return -1;
+		}
+		memset(nson, 0, sizeof(*nson));
+		return 0;
+	case 't':
+		if (len != 4 || memcmp(src, "true", 4)) {
+			return -1;
+		}
+		return nson_bool_wrap(nson, 1);
+	case 'f':
+		if (len != 5 || memcmp(src, "false", 5)) {
+			return -1;
+		}
+		return nson_bool_wrap(nson, 0);
+	case '-':
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		return __nson_parse_number(nson, src, len) == len ? 0 : -1;
+	default:
+		return -1;
+	}
+}
+
+int
+__nson_parse_json_string_insitu(Nson *nson, char *src, size_t len) {
+	if (len > UINT32_MAX) {
+		// too long to be referenced, see __nson_init_ref()
+		return __nson_parse_json_string(nson, src, len) < 0 ? -1 : 0;
+	}
+	// Overwrites the closing quote
+	src[len] = '\0';
+	__nson_init_ref(nson, src, len, NSON_STR);
+	if (memchr(src, '\\', len) != NULL) {
+		nson->c.flags |= NSON_FLAG_ESCAPED;
+	}
+	return 0;
+}
+
+static const char *const json_control_escapes[] = {
+		"\\u0000", "\\u0001", "\\u0002", "\\u0003",
+		"\\u0004", "\\u0005", "\\u0006", "\\u0007",
+		"\\b", "\\t", "\\n", "\\u000b",
+		"\\f", "\\r", "\\u000e", "\\u000f",
+		"\\u0010", "\\u0011", "\\u0012", "\\u0013",
+		"\\u0014", "\\u0015", "\\u0016", "\\u0017",
+		"\\u0018", "\\u0019", "\\u001a", "\\u001b",
+		"\\u001c", "\\u001d", "\\u001e", "\\u001f",
+};
+
+static void
+json_escape_utf8(NsonWriter *out, uint32_t chr) {
+	char *p;
+	static const char hex[] = "0123456789abcdef";
+
+	if (chr > 0xffff) {
+		// encode as UTF-16 surrogate pair
+		chr -= 0x10000;
+		json_escape_utf8(out, 0xd800 | (chr >> 10));
+		chr = 0xdc00 | (chr & 0x3ff);
+	}
+	p = __nson_writer_reserve(out, 6);
+	if (p == NULL) {
+		return;
+	}
+	p[0] = '\\';
+	p[1] = 'u';
+	p[2] = hex[chr >> 12];
+	p[3] = hex[(chr >> 8) & 0xf];
+	p[4] = hex[(chr >> 4) & 0xf];
+	p[5] = hex[chr & 0xf];
+	out->len += 6;
+}
+
+int
+__nson_json_write_string(
+		NsonWriter *out, const char *data, size_t len,
+		enum NsonOptions options) {
+	size_t i, n;
+	uint32_t chr;
+	uint8_t c;
+	const enum NsonEscapeMode mode =
+			options & NSON_ASCII ? NSON_ESCAPE_JSON_ASCII : NSON_ESCAPE_JSON;
+
+	__nson_writer_putc(out, '"');
+
+	for (i = 0; i < len; i++) {
+		n = __nson_escape_span(&data[i], len - i, mode);
+		__nson_writer_write(out, &data[i], n);
+		i += n;
+		if (i == len) {
 			break;
 		}
 
-		if (c[1] != 0) {
-			rv = -1;
-			if (fwrite(&data[last_write], sizeof(*data), i - last_write, fd) ==
-				0) {
-				goto cleanup;
-			}
-			if (fwrite(c, sizeof(*data), 2, fd) == 0) {
-				goto cleanup;
-			}
-			last_write = i + 1;
-			c[1] = 0;
-		} else if (iscntrl(data[i])) {
-			rv = -1;
-			if (fwrite(&data[last_write], sizeof(*data), i - last_write, fd) ==
-				0) {
-				goto cleanup;
-			}
-			if (fprintf(fd, "\\u%04x", data[i]) == 0) {
-				goto cleanup;
-			}
-			last_write = i + 1;
+		c = data[i];
+		if (c == '"' || c == '\\') {
+			__nson_writer_putc(out, '\\');
+			__nson_writer_putc(out, c);
+		} else if (c < 0x20) {
+			__nson_writer_puts(out, json_control_escapes[c]);
+		} else {
+			i += __nson_utf8_decode(&chr, &data[i], len - i) - 1;
+			json_escape_utf8(out, chr);
 		}
 	}
 
-	if (i != last_write &&
-		fwrite(&data[last_write], sizeof(*data), i - last_write, fd) == 0) {
-		return -1;
-	}
-	fputc('"', fd);
+	__nson_writer_putc(out, '"');
 
-	rv = i;
-cleanup:
-	return rv;
+	return out->error ? -1 : i;
 }
 
 int
@@ -184,91 +358,154 @@ nson_load_json(Nson *nson, const char *file) {
 	return nson_load(nson_parse_json, nson, file);
 }
 
-int
-nson_parse_json(Nson *nson, const char *doc, size_t len) {
-	int rv = 0;
-	off_t row = 0;
-	int i;
-	// int line_start = 0;
-	Nson *stack_top;
-	Nson old_top = {0};
-	Nson stack = {{{0}}}, tmp = {{{0}}};
-	NsonBuf *buf;
+size_t
+nson_json_unescape(char *dest, const char *src, size_t len) {
+	return __nson_json_unescape(dest, src, len);
+}
 
-	memset(nson, 0, sizeof(*nson));
-	nson_init(&tmp, NSON_ARR);
-	nson_init_arr(&stack);
-	nson_arr_push(&stack, &tmp);
-
-	/* UNUSED */
-	//(void)line_start;
-
-	stack_top = nson_arr_get(&stack, 0);
-	// Skip leading Whitespaces
-	for (i = 0; i < len && isspace(doc[i]); i++)
-		;
-	if (i >= len) {
-		rv = -1;
-		goto out;
+enum JsonFrame {
+	JSON_FRAME_ARR,
+	JSON_FRAME_KEY,
+	JSON_FRAME_VALUE,
+};
+
+typedef struct JsonTokenizer {
+	uint8_t *frames;
+	size_t depth;
+	size_t frames_cap;
+} JsonTokenizer;
+
+static int
+tokenizer_open(JsonTokenizer *tok, enum JsonFrame frame) {
+	uint8_t *frames;
+	size_t cap;
+
+	if (tok->depth == tok->frames_cap) {
+		cap = tok->frames_cap ? tok->frames_cap * 2 : 32;
+		frames = realloc(tok->frames, cap);
+		if (frames == NULL) {
+			return -1;
+		}
+		tok->frames = frames;
+		tok->frames_cap = cap;
 	}
+	tok->frames[tok->depth++] = frame;
+	return 0;
+}
+
+static int
+tokenizer_close(JsonTokenizer *tok, enum JsonFrame frame) {
+	// An object may only be closed after a complete key value pair
+	if (tok->depth == 0 || tok->frames[tok->depth - 1] != frame) {
+		return -1;
+	}
+	tok->depth--;
+	return 0;
+}
+
+/*
+ * Flips objects between the key and the value position after one of their
+ * members was read.
+ */
+static void
+tokenizer_advance(JsonTokenizer *tok) {
+	uint8_t *frame;
+
+	if (tok->depth == 0) {
+		return;
+	}
+	frame = &tok->frames[tok->depth - 1];
+	if (*frame == JSON_FRAME_KEY) {
+		*frame = JSON_FRAME_VALUE;
+	} else if (*frame == JSON_FRAME_VALUE) {
+		*frame = JSON_FRAME_KEY;
+	}
+}
+
+static bool
+tokenizer_at_key(const JsonTokenizer *tok) {
+	return tok->depth > 0 && tok->frames[tok->depth - 1] == JSON_FRAME_KEY;
+}
+
+#define JSON_EVENT(events, name, ...) \
+	((events)->name ? (events)->name(__VA_ARGS__) : 0)
+
+/*
+ * Reads the first value of @p doc and reports its tokens to @p events.
+ * Only the nesting of the open containers is kept, so the memory used is
+ * bound by the depth of the document.
+ */
+static int
+json_tokenize(
+		JsonTokenizer *tok, const char *doc, size_t len,
+		const NsonJsonEvents *events, void *user_data) {
+	int rv = 0;
+	off_t i, end = 0;
+	Nson tmp = {{{0}}};
+	NsonScanner scan;
+	const size_t base = tok->depth;
+
+	__nson_scan_init(&scan, doc, len);
 	do {
+		i = __nson_scan_next(&scan);
+		if (i < 0 && base > 0 && tok->depth == base) {
+			// Containers opened by the caller end with @p doc
+			return len;
+		} else if (i < 0) {
+			// Premature EOF
+			return -1;
+		}
+		end = i + 1;
+		if (tokenizer_at_key(tok) && doc[i] != '"' && doc[i] != '}' &&
+			doc[i] != ',') {
+			return -1;
+		}
 		switch (doc[i]) {
 		case '[':
+			rv = tokenizer_open(tok, JSON_FRAME_ARR);
+			if (rv >= 0) {
+				rv = JSON_EVENT(events, begin_array, user_data);
+			}
+			break;
 		case '{':
-			nson_init(&tmp, NSON_ARR);
-			nson_arr_push(&stack, &tmp);
-			stack_top = nson_arr_last(&stack);
-			i++;
+			rv = tokenizer_open(tok, JSON_FRAME_KEY);
+			if (rv >= 0) {
+				rv = JSON_EVENT(events, begin_object, user_data);
+			}
 			break;
 		case ',':
 		case ':':
-			i++;
 			break;
-		case '}':
-			if (nson_arr_len(stack_top) % 2 != 0) {
-				rv = -1;
-				goto out;
-			}
-			if (nson_obj_from_arr(stack_top) < 0) {
-				rv = -1;
-				goto out;
-			}
-			// no break
 		case ']':
-			nson_arr_pop(&old_top, &stack);
-			stack_top = nson_arr_last(&stack);
-			if (stack_top == NULL) {
-				rv = -1;
-				goto out;
+			rv = tokenizer_close(tok, JSON_FRAME_ARR);
+			if (rv >= 0) {
+				tokenizer_advance(tok);
+				rv = JSON_EVENT(events, end_array, user_data);
+			}
+			break;
+		case '}':
+			rv = tokenizer_close(tok, JSON_FRAME_KEY);
+			if (rv >= 0) {
+				tokenizer_advance(tok);
+				rv = JSON_EVENT(events, end_object, user_data);
 			}
-			nson_arr_push(stack_top, &old_top);
-			i++;
 			break;
 		case '"':
-			i++; // Skip quote
-			rv = json_str_len(&doc[i], len - i);
-			if (rv < 0) {
-				goto out;
+			// The scanner reports the closing quote as the next offset
+			end = __nson_scan_next(&scan);
+			if (end < 0) {
+				return -1;
 			}
-			if (doc[rv + i] != '"') {
-				rv = -1;
-				goto out;
+			assert(doc[end] == '"');
+			if (tokenizer_at_key(tok)) {
+				rv = JSON_EVENT(
+						events, key, user_data, &doc[i + 1], end - i - 1);
+			} else {
+				rv = JSON_EVENT(
+						events, string, user_data, &doc[i + 1], end - i - 1);
 			}
-			parse_json_string(&buf, &doc[i], rv);
-			__nson_init_buf(&tmp, buf, NSON_STR);
-			nson_arr_push(stack_top, &tmp);
-			__nson_buf_release(buf);
-			i += rv + 1; // Skip text + quote
-			break;
-		case '\n':
-			// line_start = i + 1;
-			row++;
-		case '\f':
-		case '\r':
-		case '\t':
-		case '\v':
-		case ' ':
-			i++;
+			tokenizer_advance(tok);
+			end++;
 			break;
 		case '-':
 		case '0':
@@ -282,100 +519,399 @@ nson_parse_json(Nson *nson, const char *doc, size_t len) {
 		case '8':
 		case '9':
 			rv = __nson_parse_number(&tmp, &doc[i], len - i);
-			if (rv < 0) {
-				goto out;
+			if (rv <= 0 || !json_scalar_end(doc, len, i + rv)) {
+				return -1;
 			}
-			i += rv;
-			nson_arr_push(stack_top, &tmp);
+			end = i + rv;
+			if (nson_type(&tmp) == NSON_INT) {
+				rv = JSON_EVENT(events, integer, user_data, nson_int(&tmp));
+			} else {
+				rv = JSON_EVENT(events, real, user_data, nson_real(&tmp));
+			}
+			tokenizer_advance(tok);
 			break;
 		case 'n':
-			if (len - i > 4 && memcmp(&doc[i], "null", 4)) {
-				rv = -1;
-				goto out;
+			if (len - i < 4 || memcmp(&doc[i], "null", 4) ||
+				!json_scalar_end(doc, len, i + 4)) {
+				return -1;
 			}
-			nson_init_data(&tmp, NULL, 0, NSON_STR);
-			nson_arr_push(stack_top, &tmp);
-			i += 4;
+			rv = JSON_EVENT(events, null, user_data);
+			tokenizer_advance(tok);
+			end = i + 4;
 			break;
 		case 't':
-			if (len - i > 4 && memcmp(&doc[i], "true", 4)) {
-				rv = -1;
-				goto out;
+			if (len - i < 4 || memcmp(&doc[i], "true", 4) ||
+				!json_scalar_end(doc, len, i + 4)) {
+				return -1;
 			}
-			nson_bool_wrap(&tmp, 1);
-			nson_arr_push(stack_top, &tmp);
-			i += 4;
+			rv = JSON_EVENT(events, boolean, user_data, true);
+			tokenizer_advance(tok);
+			end = i + 4;
 			break;
 		case 'f':
-			if (len - i > 5 && memcmp(&doc[i], "false", 5)) {
-				rv = -1;
-				goto out;
+			if (len - i < 5 || memcmp(&doc[i], "false", 5) ||
+				!json_scalar_end(doc, len, i + 5)) {
+				return -1;
 			}
-			nson_bool_wrap(&tmp, 0);
-			nson_arr_push(stack_top, &tmp);
-			i += 5;
+			rv = JSON_EVENT(events, boolean, user_data, false);
+			tokenizer_advance(tok);
+			end = i + 5;
 			break;
 		default:
 			rv = -1;
-			goto out;
-			nson_arr_push(stack_top, &tmp);
+			break;
+		}
+		if (rv < 0) {
+			return rv;
 		}
-	} while (nson_arr_len(&stack) > 1 && i < len);
+	} while (tok->depth > 0 && tok->depth >= base);
 
-	if (nson_arr_len(&stack) != 1 || nson_arr_len(stack_top) != 1) {
-		// Premature EOF
-		rv = -1;
-		goto out;
-	}
-	nson_move(nson, nson_arr_get(stack_top, 0));
+	// The containers of the caller must not be closed inside of @p doc
+	return base > 0 ? -1 : end;
+}
 
-	rv = i;
-out:
-	nson_clean(&stack);
+int
+nson_parse_json_events(
+		const char *doc, size_t len, const NsonJsonEvents *events,
+		void *user_data) {
+	int rv;
+	JsonTokenizer tok = {0};
+
+	rv = json_tokenize(&tok, doc, len, events, user_data);
+	free(tok.frames);
 	return rv;
 }
 
+/*
+ * The tree of nson_parse_json() is assembled from the same events that
+ * are reported by nson_parse_json_events().
+ */
+typedef struct JsonDomBuilder {
+	NsonBuilder builder;
+	const char *doc;
+	char *insitu;
+	NsonBuf **intern;
+	size_t intern_len;
+	size_t intern_cap;
+} JsonDomBuilder;
+
+/*
+ * Keys are interned while a document is parsed, so records with the same
+ * keys share one buffer per distinct key. Short keys are stored inline
+ * instead. Long keys and keys with escape sequences are not interned, as
+ * the latter are decoded in place on their first access. The table stops
+ * growing at INTERN_MAX_SLOTS, keys of documents with many distinct keys
+ * are mostly unique anyway.
+ */
+#define INTERN_MAX_KEY 64
+#define INTERN_MAX_SLOTS 4096
+
+static NsonBuf **
+intern_slot(NsonBuf **slots, size_t cap, const char *str, size_t len) {
+	size_t i = __nson_hash(str, len) & (cap - 1);
+
+	for (; slots[i]; i = (i + 1) & (cap - 1)) {
+		if (__nson_buf_siz(slots[i]) == len &&
+			memcmp(__nson_buf(slots[i]), str, len) == 0) {
+			break;
+		}
+	}
+	return &slots[i];
+}
+
+static int
+intern_grow(JsonDomBuilder *dom) {
+	size_t i;
+	NsonBuf **slots, *buf;
+	const size_t cap = dom->intern_cap ? dom->intern_cap * 2 : 16;
+
+	slots = calloc(cap, sizeof(*slots));
+	if (slots == NULL) {
+		return -1;
+	}
+	for (i = 0; i < dom->intern_cap; i++) {
+		if ((buf = dom->intern[i])) {
+			*intern_slot(slots, cap, __nson_buf(buf), __nson_buf_siz(buf)) =
+					buf;
+		}
+	}
+	free(dom->intern);
+	dom->intern = slots;
+	dom->intern_cap = cap;
+	return 0;
+}
+
+static void
+dom_clean(JsonDomBuilder *dom) {
+	size_t i;
+
+	for (i = 0; i < dom->intern_cap; i++) {
+		if (dom->intern[i]) {
+			__nson_buf_release(dom->intern[i]);
+		}
+	}
+	free(dom->intern);
+	__nson_builder_clean(&dom->builder);
+}
+
+static int
+dom_begin_array(void *user_data) {
+	JsonDomBuilder *dom = user_data;
+	return __nson_builder_open(&dom->builder, NSON_ARR);
+}
+
+static int
+dom_end_array(void *user_data) {
+	JsonDomBuilder *dom = user_data;
+	return __nson_builder_close(&dom->builder, NSON_ARR);
+}
+
+static int
+dom_begin_object(void *user_data) {
+	JsonDomBuilder *dom = user_data;
+	return __nson_builder_open(&dom->builder, NSON_OBJ);
+}
+
+static int
+dom_end_object(void *user_data) {
+	JsonDomBuilder *dom = user_data;
+	return __nson_builder_close(&dom->builder, NSON_OBJ);
+}
+
+static int
+dom_string(void *user_data, const char *str, size_t len) {
+	int rv;
+	char *copy;
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+	NsonArena *arena = dom->builder.arena;
+
+	if (dom->insitu) {
+		rv = __nson_parse_json_string_insitu(
+				&tmp, &dom->insitu[str - dom->doc], len);
+	} else if (arena && len > NSON_INLINE_SIZE) {
+		copy = __nson_arena_strndup(arena, str, len);
+		rv = copy ? __nson_parse_json_string_insitu(&tmp, copy, len) : -1;
+	} else {
+		rv = __nson_parse_json_string(&tmp, str, len);
+	}
+	if (rv < 0) {
+		return -1;
+	}
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static int
+dom_key(void *user_data, const char *str, size_t len) {
+	NsonBuf **slot, *buf, *owned = NULL;
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+
+	if (dom->insitu || dom->builder.arena || len <= NSON_INLINE_SIZE ||
+		len > INTERN_MAX_KEY || memchr(str, '\\', len)) {
+		return dom_string(user_data, str, len);
+	}
+	if (dom->intern_len * 2 >= dom->intern_cap &&
+		dom->intern_cap < INTERN_MAX_SLOTS && intern_grow(dom) < 0) {
+		return -1;
+	}
+
+	slot = intern_slot(dom->intern, dom->intern_cap, str, len);
+	if ((buf = *slot) == NULL) {
+		buf = __nson_buf_wrap(str, len);
+		if (buf == NULL) {
+			return -1;
+		} else if (dom->intern_len * 2 < dom->intern_cap) {
+			*slot = buf;
+			dom->intern_len++;
+		} else {
+			owned = buf;
+		}
+	}
+	__nson_init_buf(&tmp, buf, NSON_STR);
+	if (owned) {
+		__nson_buf_release(owned);
+	}
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static int
+dom_integer(void *user_data, int64_t value) {
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+
+	nson_int_wrap(&tmp, value);
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static int
+dom_real(void *user_data, double value) {
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+
+	nson_real_wrap(&tmp, value);
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static int
+dom_boolean(void *user_data, bool value) {
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+
+	nson_bool_wrap(&tmp, value);
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static int
+dom_null(void *user_data) {
+	Nson tmp = {{{0}}};
+	JsonDomBuilder *dom = user_data;
+
+	// tmp is NSON_NIL
+	return __nson_builder_push(&dom->builder, &tmp);
+}
+
+static const NsonJsonEvents dom_events = {
+		.begin_array = dom_begin_array,
+		.end_array = dom_end_array,
+		.begin_object = dom_begin_object,
+		.end_object = dom_end_object,
+		.key = dom_key,
+		.string = dom_string,
+		.integer = dom_integer,
+		.real = dom_real,
+		.boolean = dom_boolean,
+		.null = dom_null,
+};
+
 static int
-json_b64_enc(const Nson *nson, FILE *fd) {
+json_parse(
+		Nson *nson, const char *doc, size_t len, char *insitu,
+		NsonArena *arena) {
 	int rv = 0;
-	Nson tmp;
+	JsonTokenizer tok = {0};
+	JsonDomBuilder dom = {
+			.builder = {.arena = arena}, .doc = doc, .insitu = insitu};
+
+	memset(nson, 0, sizeof(*nson));
 
-	if (nson_clone(&tmp, nson)) {
+	rv = json_tokenize(&tok, doc, len, &dom_events, &dom);
+	if (rv >= 0 && __nson_builder_finish(&dom.builder, nson) < 0) {
 		rv = -1;
 	}
-	if (nson_mapper_b64_enc(0, &tmp, NULL) < 0) {
-		rv = -1;
-	} else if (fputc('"', fd) < 0) {
-		rv = -1;
-	} else if (
-			fwrite(nson_data(&tmp), sizeof(char), nson_data_len(&tmp), fd) ==
-			0) {
-		rv = -1;
-	} else if (fputc('"', fd) < 0) {
+
+	free(tok.frames);
+	dom_clean(&dom);
+	return rv;
+}
+
+/*
+ * Parses the comma separated elements of an array without the enclosing
+ * brackets into @p array.
+ */
+int
+__nson_parse_json_elements(Nson *array, const char *doc, size_t len) {
+	int rv = 0;
+	JsonTokenizer tok = {0};
+	JsonDomBuilder dom = {.doc = doc};
+
+	memset(array, 0, sizeof(*array));
+
+	rv = tokenizer_open(&tok, JSON_FRAME_ARR);
+	if (rv >= 0) {
+		rv = dom_begin_array(&dom);
+	}
+	if (rv >= 0) {
+		rv = json_tokenize(&tok, doc, len, &dom_events, &dom);
+	}
+	if (rv >= 0) {
+		rv = dom_end_array(&dom);
+	}
+	if (rv >= 0) {
+		rv = __nson_builder_finish(&dom.builder, array);
+	}
+
+	free(tok.frames);
+	dom_clean(&dom);
+	return rv;
+}
+
+int
+nson_parse_json_ctx(
+		NsonParseContext *ctx, Nson *nson, const char *doc, size_t len) {
+	int rv = 0;
+	JsonTokenizer tok = {.frames = ctx->frames, .frames_cap = ctx->frames_cap};
+	JsonDomBuilder dom = {.builder = ctx->builder, .doc = doc};
+
+	memset(nson, 0, sizeof(*nson));
+	__nson_arena_reset(&ctx->arena);
+	dom.builder.arena = &ctx->arena;
+
+	rv = json_tokenize(&tok, doc, len, &dom_events, &dom);
+	if (rv >= 0 && __nson_builder_finish(&dom.builder, nson) < 0) {
 		rv = -1;
 	}
-	nson_clean(&tmp);
+
+	__nson_builder_reset(&dom.builder);
+	ctx->builder = dom.builder;
+	ctx->frames = tok.frames;
+	ctx->frames_cap = tok.frames_cap;
 	return rv;
 }
 
 int
-nson_json_serialize(
-		char **str, size_t *size, Nson *nson, enum NsonOptions options) {
-	int rv;
-	FILE *out = open_memstream(str, size);
-	if (out == NULL) {
+nson_parse_json(Nson *nson, const char *doc, size_t len) {
+	return json_parse(nson, doc, len, NULL, NULL);
+}
+
+int
+__nson_parse_json_insitu(Nson *nson, char *doc, size_t len) {
+	return json_parse(nson, doc, len, doc, NULL);
+}
+
+int
+__nson_parse_json_arena(
+		Nson *nson, const char *doc, size_t len, NsonArena *arena) {
+	return json_parse(nson, doc, len, NULL, arena);
+}
+
+static int
+json_b64_enc(NsonWriter *out, const Nson *nson) {
+	__nson_writer_putc(out, '"');
+	__nson_writer_write_b64(out, nson_data(nson), nson_data_len(nson));
+	return __nson_writer_putc(out, '"');
+}
+
+int
+__nson_json_write_int(NsonWriter *out, int64_t value) {
+	char *num = __nson_writer_reserve(out, NSON_FORMAT_SIZE);
+
+	if (num == NULL) {
 		return -1;
 	}
-	rv = nson_json_write(out, nson, options);
-	fclose(out);
-	return rv;
+	out->len += __nson_format_int(num, value);
+	return 0;
 }
 
 int
-nson_json_write(FILE *out, const Nson *nson, enum NsonOptions options) {
+__nson_json_write_real(NsonWriter *out, double value) {
+	char *num;
+
+	// JSON has no representation for infinity and NaN
+	if (!isfinite(value)) {
+		return __nson_writer_write(out, "null", 4);
+	} else if ((num = __nson_writer_reserve(out, NSON_FORMAT_SIZE)) == NULL) {
+		return -1;
+	}
+	out->len += __nson_format_real(num, value);
+	return 0;
+}
+
+static int
+json_write(NsonWriter *out, const Nson *nson, enum NsonOptions options) {
 	int rv = 0;
 	static const NsonSerializerInfo info = {
-			.serializer = nson_json_write,
+			.serializer = json_write,
 			.seperator = ",",
 			.key_value_seperator = ":",
 	};
@@ -383,33 +919,86 @@ nson_json_write(FILE *out, const Nson *nson, enum NsonOptions options) {
 	switch (nson_type(nson)) {
 	case NSON_POINTER:
 	case NSON_NIL:
-		fputs("null", out);
+		rv = __nson_writer_write(out, "null", 4);
 		break;
 	case NSON_STR:
-		json_escape_string(nson, out);
+		rv = __nson_json_write_string(
+				out, nson_data(nson), nson_data_len(nson), options);
 		break;
 	case NSON_BLOB:
-		json_b64_enc(nson, out);
+		rv = json_b64_enc(out, nson);
 		break;
 	case NSON_REAL:
-		fprintf(out, "%f", nson_real(nson));
+		rv = __nson_json_write_real(out, nson_real(nson));
 		break;
 	case NSON_INT:
-		fprintf(out, "%" PRId64, nson_int(nson));
+		rv = __nson_json_write_int(out, nson_int(nson));
 		break;
 	case NSON_BOOL:
-		fputs(nson_int(nson) ? "true" : "false", out);
+		rv = __nson_writer_puts(out, nson_int(nson) ? "true" : "false");
 		break;
 	case NSON_ARR:
-		fputc('[', out);
+		__nson_writer_putc(out, '[');
 		rv = __nson_arr_serialize(out, nson, &info, options);
-		fputc(']', out);
+		__nson_writer_putc(out, ']');
 		break;
 	case NSON_OBJ:
-		fputc('{', out);
+		__nson_writer_putc(out, '{');
 		rv = __nson_obj_serialize(out, nson, &info, options);
-		fputc('}', out);
+		__nson_writer_putc(out, '}');
 		break;
 	}
+	return out->error ? -1 : rv;
+}
+
+int
+__nson_json_write(NsonWriter *out, const Nson *nson, enum NsonOptions options) {
+	return json_write(out, nson, options);
+}
+
+int
+nson_json_serialize(
+		char **str, size_t *size, Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter out;
+
+	if (__nson_writer_init_mem(&out) < 0) {
+		return -1;
+	}
+	rv = json_write(&out, nson, options);
+	// Like open_memstream() the output is passed to the caller on error
+	if (__nson_writer_take(&out, str, size) < 0) {
+		rv = -1;
+	}
+	return rv;
+}
+
+int
+nson_json_write(FILE *out, const Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter writer;
+
+	if (__nson_writer_init_file(&writer, out) < 0) {
+		return -1;
+	}
+	rv = json_write(&writer, nson, options);
+	if (__nson_writer_finish(&writer) < 0) {
+		rv = -1;
+	}
+	return rv;
+}
+
+int
+nson_json_write_fd(int fd, const Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter writer;
+
+	if (__nson_writer_init_fd(&writer, fd) < 0) {
+		return -1;
+	}
+	rv = json_write(&writer, nson, options);
+	if (__nson_writer_finish(&writer) < 0) {
+		rv = -1;
+	}
 	return rv;
 }
@@ -0,0 +1,284 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <errno.h>
+#include <string.h>
+
+/*
+ * The emitter writes JSON as it is produced. It only keeps the state of
+ * the open containers to place separators and to reject calls that would
+ * produce invalid output.
+ */
+
+enum EmitFrame {
+	EMIT_ARR_FIRST,
+	EMIT_ARR,
+	EMIT_OBJ_FIRST_KEY,
+	EMIT_OBJ_KEY,
+	EMIT_OBJ_VALUE,
+};
+
+static int
+emit_fail(NsonEmitter *emitter) {
+	errno = EINVAL;
+	emitter->writer.error = true;
+	return -1;
+}
+
+/*
+ * Writes the separator in front of the next key or value.
+ */
+static int
+emit_prefix(NsonEmitter *emitter, bool key) {
+	uint8_t *frame;
+	NsonWriter *out = &emitter->writer;
+
+	if (out->error) {
+		return -1;
+	} else if (emitter->depth == 0) {
+		return key || emitter->done ? emit_fail(emitter) : 0;
+	}
+
+	frame = &emitter->frames[emitter->depth - 1];
+	switch (*frame) {
+	case EMIT_ARR_FIRST:
+		if (key) {
+			return emit_fail(emitter);
+		}
+		*frame = EMIT_ARR;
+		return 0;
+	case EMIT_ARR:
+		return key ? emit_fail(emitter) : __nson_writer_putc(out, ',');
+	case EMIT_OBJ_FIRST_KEY:
+		if (!key) {
+			return emit_fail(emitter);
+		}
+		*frame = EMIT_OBJ_VALUE;
+		return 0;
+	case EMIT_OBJ_KEY:
+		if (!key) {
+			return emit_fail(emitter);
+		}
+		*frame = EMIT_OBJ_VALUE;
+		return __nson_writer_putc(out, ',');
+	case EMIT_OBJ_VALUE:
+		if (key) {
+			return emit_fail(emitter);
+		}
+		*frame = EMIT_OBJ_KEY;
+		return __nson_writer_putc(out, ':');
+	}
+	return emit_fail(emitter);
+}
+
+static int
+emit_done(NsonEmitter *emitter, int rv) {
+	if (emitter->depth == 0) {
+		emitter->done = true;
+	}
+	return emitter->writer.error ? -1 : rv;
+}
+
+static int
+emit_begin(NsonEmitter *emitter, enum EmitFrame frame, char c) {
+	uint8_t *frames;
+	size_t cap;
+
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	if (emitter->depth == emitter->frames_cap) {
+		cap = emitter->frames_cap ? emitter->frames_cap * 2 : 32;
+		frames = realloc(emitter->frames, cap);
+		if (frames == NULL) {
+			emitter->writer.error = true;
+			return -1;
+		}
+		emitter->frames = frames;
+		emitter->frames_cap = cap;
+	}
+	emitter->frames[emitter->depth++] = frame;
+	return __nson_writer_putc(&emitter->writer, c);
+}
+
+static int
+emit_end(NsonEmitter *emitter, bool object, char c) {
+	enum EmitFrame frame;
+
+	if (emitter->writer.error) {
+		return -1;
+	} else if (emitter->depth == 0) {
+		return emit_fail(emitter);
+	}
+	frame = emitter->frames[emitter->depth - 1];
+	if (object ? frame != EMIT_OBJ_FIRST_KEY && frame != EMIT_OBJ_KEY
+			   : frame != EMIT_ARR_FIRST && frame != EMIT_ARR) {
+		return emit_fail(emitter);
+	}
+	emitter->depth--;
+	return emit_done(emitter, __nson_writer_putc(&emitter->writer, c));
+}
+
+static void
+emit_init(NsonEmitter *emitter, enum NsonOptions options) {
+	emitter->options = options;
+	emitter->frames = NULL;
+	emitter->depth = 0;
+	emitter->frames_cap = 0;
+	emitter->done = false;
+}
+
+int
+nson_emit_init(NsonEmitter *emitter, enum NsonOptions options) {
+	emit_init(emitter, options);
+	return __nson_writer_init_mem(&emitter->writer);
+}
+
+int
+nson_emit_init_file(
+		NsonEmitter *emitter, FILE *file, enum NsonOptions options) {
+	emit_init(emitter, options);
+	return __nson_writer_init_file(&emitter->writer, file);
+}
+
+int
+nson_emit_init_fd(NsonEmitter *emitter, int fd, enum NsonOptions options) {
+	emit_init(emitter, options);
+	return __nson_writer_init_fd(&emitter->writer, fd);
+}
+
+int
+nson_emit_begin_array(NsonEmitter *emitter) {
+	return emit_begin(emitter, EMIT_ARR_FIRST, '[');
+}
+
+int
+nson_emit_end_array(NsonEmitter *emitter) {
+	return emit_end(emitter, false, ']');
+}
+
+int
+nson_emit_begin_object(NsonEmitter *emitter) {
+	return emit_begin(emitter, EMIT_OBJ_FIRST_KEY, '{');
+}
+
+int
+nson_emit_end_object(NsonEmitter *emitter) {
+	return emit_end(emitter, true, '}');
+}
+
+int
+nson_emit_key(NsonEmitter *emitter, const char *key, size_t len) {
+	if (emit_prefix(emitter, true) < 0) {
+		return -1;
+	}
+	return __nson_json_write_string(
+			&emitter->writer, key, len, emitter->options);
+}
+
+int
+nson_emit_string(NsonEmitter *emitter, const char *str, size_t len) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(
+			emitter, __nson_json_write_string(
+							 &emitter->writer, str, len, emitter->options));
+}
+
+int
+nson_emit_int(NsonEmitter *emitter, int64_t value) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(emitter, __nson_json_write_int(&emitter->writer, value));
+}
+
+int
+nson_emit_real(NsonEmitter *emitter, double value) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(
+			emitter, __nson_json_write_real(&emitter->writer, value));
+}
+
+int
+nson_emit_bool(NsonEmitter *emitter, bool value) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(
+			emitter,
+			__nson_writer_puts(&emitter->writer, value ? "true" : "false"));
+}
+
+int
+nson_emit_null(NsonEmitter *emitter) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(emitter, __nson_writer_write(&emitter->writer, "null", 4));
+}
+
+int
+nson_emit_value(NsonEmitter *emitter, const Nson *value) {
+	if (emit_prefix(emitter, false) < 0) {
+		return -1;
+	}
+	return emit_done(
+			emitter,
+			__nson_json_write(&emitter->writer, value, emitter->options));
+}
+
+int
+nson_emit_finish(NsonEmitter *emitter, char **str, size_t *size) {
+	int rv = 0;
+
+	if (emitter->writer.error) {
+		rv = -1;
+	} else if (emitter->depth > 0 || !emitter->done) {
+		errno = EINVAL;
+		rv = -1;
+	}
+	if (emitter->writer.sink == NULL && rv >= 0 && str) {
+		rv = __nson_writer_take(&emitter->writer, str, size);
+	} else if (__nson_writer_finish(&emitter->writer) < 0) {
+		rv = -1;
+	}
+	if (rv < 0 && str) {
+		*str = NULL;
+	}
+
+	free(emitter->frames);
+	emit_init(emitter, 0);
+	return rv;
+}
@@ -0,0 +1,200 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <errno.h>
+#include <string.h>
+
+/*
+ * Lazy documents keep arrays and objects as NsonLazy references to their
+ * source. A container is read one level deep on its first access: its
+ * scalars are parsed while nested containers are skipped by matching
+ * their brackets and become lazy references themselves.
+ */
+
+static bool
+is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' ||
+			c == '\v';
+}
+
+static int lazy_read(Nson *nson, char *src, size_t len);
+
+/*
+ * Reads the value at @p i. Containers are not read but referenced.
+ *
+ * @return the end of the value or < 0 on error
+ */
+static off_t
+lazy_value(Nson *nson, char *doc, size_t len, size_t i) {
+	int rv;
+	off_t end;
+
+	switch (doc[i]) {
+	case '"':
+		end = __nson_json_string_end(doc, len, i);
+		if (end < 0) {
+			return -1;
+		}
+		rv = __nson_parse_json_string_insitu(nson, &doc[i + 1], end - i - 1);
+		return rv < 0 ? -1 : end + 1;
+	case '[':
+	case '{':
+		end = __nson_json_value_end(doc, len, i);
+		if (end < 0) {
+			return -1;
+		}
+		nson_init(nson, doc[i] == '[' ? NSON_ARR : NSON_OBJ);
+		if (end - i > UINT32_MAX) {
+			// spans that do not fit into an NsonLazy are read right away
+			lazy_read(nson, &doc[i], end - i);
+		} else {
+			nson->c.flags |= NSON_FLAG_LAZY;
+			nson->l.src = &doc[i];
+			nson->l.len = end - i;
+		}
+		return end;
+	default:
+		for (end = i; end < len && !__nson_json_delimiter(doc[end]); end++)
+			;
+		if (end == i || __nson_parse_json_scalar(nson, &doc[i], end - i) < 0) {
+			return -1;
+		}
+		return end;
+	}
+}
+
+static int
+push_value(Nson **values, size_t *len, size_t *cap, Nson *value) {
+	Nson *new_values;
+
+	if (*len == *cap) {
+		*cap = *cap ? *cap * 2 : 16;
+		new_values = reallocarray(*values, *cap, sizeof(**values));
+		if (new_values == NULL) {
+			nson_clean(value);
+			return -1;
+		}
+		*values = new_values;
+	}
+	nson_move(&(*values)[(*len)++], value);
+	return 0;
+}
+
+/*
+ * Reads the container that spans @p size bytes of @p src into @p nson.
+ */
+static int
+lazy_read(Nson *nson, char *src, size_t size) {
+	int rv = 0;
+	off_t end;
+	size_t i, values_len = 0, values_cap = 0;
+	Nson tmp = {{{0}}}, *values = NULL;
+	const enum NsonType type = nson_type(nson);
+	// The closing bracket is not part of the elements
+	const size_t len = size - 1;
+
+	for (i = 1; i < len && rv >= 0;) {
+		if (is_space(src[i]) || src[i] == ',' || src[i] == ':') {
+			i++;
+			continue;
+		} else if (type == NSON_OBJ && values_len % 2 == 0 && src[i] != '"') {
+			// object keys must be strings
+			rv = -1;
+			break;
+		}
+		end = lazy_value(&tmp, src, len, i);
+		if (end < 0) {
+			rv = -1;
+		} else {
+			rv = push_value(&values, &values_len, &values_cap, &tmp);
+			i = end;
+		}
+	}
+	if (type == NSON_OBJ && values_len % 2 != 0) {
+		rv = -1;
+	}
+
+	if (rv >= 0) {
+		rv = __nson_arr_init_move(nson, values, values_len, NULL);
+	}
+	if (rv >= 0 && type == NSON_OBJ) {
+		rv = nson_obj_from_arr(nson);
+	}
+	if (rv < 0) {
+		// An invalid container reads as empty
+		for (i = 0; i < values_len; i++) {
+			nson_clean(&values[i]);
+		}
+		nson_init(nson, type);
+		errno = EINVAL;
+	}
+	free(values);
+	return rv;
+}
+
+int
+__nson_lazy_load(Nson *nson) {
+	return lazy_read(nson, nson->l.src, nson->l.len);
+}
+
+/*
+ * Reads a lazy container and all of its children without modifying the
+ * source, so the result does not depend on the document. The span has
+ * not been read yet, so the eager parser takes it in a single pass.
+ */
+int
+__nson_lazy_copy(Nson *nson) {
+	const enum NsonType type = nson_type(nson);
+	const char *src = nson->l.src;
+	const size_t len = nson->l.len;
+
+	if (nson_parse_json(nson, src, len) < 0) {
+		// An invalid container reads as empty
+		nson_init(nson, type);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int
+__nson_parse_json_lazy(Nson *nson, char *doc, size_t len) {
+	size_t i;
+
+	memset(nson, 0, sizeof(*nson));
+	for (i = 0; i < len && is_space(doc[i]); i++)
+		;
+	if (i == len) {
+		// Premature EOF
+		return -1;
+	}
+	return lazy_value(nson, doc, len, i);
+}
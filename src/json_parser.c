@@ -0,0 +1,314 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <errno.h>
+#include <string.h>
+
+/*
+ * The incremental parser tokenizes every chunk it is fed. Tokens that are
+ * complete within a chunk are parsed in place, only a token that is cut
+ * off by the end of a chunk is copied to the pending buffer and completed
+ * by the following chunks.
+ */
+
+enum ParserState {
+	PARSER_VALUE,
+	PARSER_STRING,
+	PARSER_SCALAR,
+	PARSER_DONE,
+	PARSER_ERROR,
+};
+
+static bool
+is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' ||
+			c == '\v';
+}
+
+static int
+pending_append(NsonJsonParser *parser, const char *src, size_t len) {
+	char *pending;
+	size_t cap = parser->pending_cap ? parser->pending_cap : 64;
+
+	while (cap - parser->pending_len < len) {
+		if (cap > SIZE_MAX / 2) {
+			errno = ENOMEM;
+			return -1;
+		}
+		cap *= 2;
+	}
+	if (cap != parser->pending_cap) {
+		pending = realloc(parser->pending, cap);
+		if (pending == NULL) {
+			return -1;
+		}
+		parser->pending = pending;
+		parser->pending_cap = cap;
+	}
+	memcpy(&parser->pending[parser->pending_len], src, len);
+	parser->pending_len += len;
+	return 0;
+}
+
+/*
+ * Returns the offset of the closing quote of the current string or -1 if
+ * the string continues in the next chunk.
+ */
+static off_t
+string_end(NsonJsonParser *parser, const char *chunk, size_t i, size_t len) {
+	while (i < len) {
+		if (parser->escaped) {
+			parser->escaped = false;
+			i++;
+			continue;
+		}
+		i += __nson_escape_span(&chunk[i], len - i, NSON_ESCAPE_JSON);
+		if (i == len) {
+			break;
+		} else if (chunk[i] == '"') {
+			return i;
+		} else if (chunk[i] == '\\') {
+			parser->escaped = true;
+		}
+		i++;
+	}
+	return -1;
+}
+
+static size_t
+scalar_end(const char *chunk, size_t i, size_t len) {
+	for (; i < len && !__nson_json_delimiter(chunk[i]); i++)
+		;
+	return i;
+}
+
+/*
+ * Returns true if the next value of the innermost container is an object
+ * key, which has to be a string.
+ */
+static bool
+expects_key(const NsonJsonParser *parser) {
+	const NsonBuilder *builder = &parser->builder;
+	const NsonBuilderFrame *frame;
+
+	if (builder->depth == 0) {
+		return false;
+	}
+	frame = &builder->frames[builder->depth - 1];
+	return frame->type == NSON_OBJ && (builder->len - frame->start) % 2 == 0;
+}
+
+static int
+push_value(NsonJsonParser *parser, Nson *value) {
+	if (__nson_builder_push(&parser->builder, value) < 0) {
+		return -1;
+	}
+	if (parser->builder.depth == 0) {
+		parser->state = PARSER_DONE;
+	} else {
+		parser->state = PARSER_VALUE;
+	}
+	return 0;
+}
+
+static int
+push_string(NsonJsonParser *parser, const char *src, size_t len) {
+	Nson tmp = {{{0}}};
+
+	if (__nson_parse_json_string(&tmp, src, len) < 0) {
+		return -1;
+	}
+	return push_value(parser, &tmp);
+}
+
+static int
+push_scalar(NsonJsonParser *parser, const char *src, size_t len) {
+	Nson tmp = {{{0}}};
+
+	if (__nson_parse_json_scalar(&tmp, src, len) < 0) {
+		return -1;
+	}
+	return push_value(parser, &tmp);
+}
+
+static int
+parse_token(NsonJsonParser *parser, const char *chunk, size_t len, size_t *i) {
+	int rv = 0;
+	off_t end;
+	size_t start = *i;
+
+	switch (chunk[start]) {
+	case ' ':
+	case '\n':
+	case '\r':
+	case '\t':
+	case '\f':
+	case '\v':
+	case ',':
+	case ':':
+		*i = start + 1;
+		break;
+	case '[':
+	case '{':
+		if (expects_key(parser)) {
+			// object keys must be strings
+			rv = -1;
+			break;
+		}
+		rv = __nson_builder_open(
+				&parser->builder, chunk[start] == '[' ? NSON_ARR : NSON_OBJ);
+		*i = start + 1;
+		break;
+	case ']':
+	case '}':
+		rv = __nson_builder_close(
+				&parser->builder, chunk[start] == ']' ? NSON_ARR : NSON_OBJ);
+		if (rv >= 0 && parser->builder.depth == 0) {
+			parser->state = PARSER_DONE;
+		}
+		*i = start + 1;
+		break;
+	case '"':
+		start++;
+		parser->escaped = false;
+		end = string_end(parser, chunk, start, len);
+		if (end >= 0) {
+			rv = push_string(parser, &chunk[start], end - start);
+			*i = end + 1;
+		} else {
+			rv = pending_append(parser, &chunk[start], len - start);
+			parser->state = PARSER_STRING;
+			*i = len;
+		}
+		break;
+	default:
+		if (expects_key(parser)) {
+			rv = -1;
+			break;
+		}
+		end = scalar_end(chunk, start, len);
+		if (end < len) {
+			rv = push_scalar(parser, &chunk[start], end - start);
+		} else {
+			rv = pending_append(parser, &chunk[start], end - start);
+			parser->state = PARSER_SCALAR;
+		}
+		*i = end;
+		break;
+	}
+	return rv;
+}
+
+int
+nson_json_parser_init(NsonJsonParser *parser) {
+	memset(parser, 0, sizeof(*parser));
+	parser->state = PARSER_VALUE;
+	return 0;
+}
+
+int
+nson_json_parser_feed(NsonJsonParser *parser, const char *chunk, size_t len) {
+	int rv = 0;
+	off_t end;
+	size_t i = 0;
+
+	while (i < len && rv >= 0) {
+		switch (parser->state) {
+		case PARSER_VALUE:
+			rv = parse_token(parser, chunk, len, &i);
+			break;
+		case PARSER_STRING:
+			end = string_end(parser, chunk, i, len);
+			if (end < 0) {
+				rv = pending_append(parser, &chunk[i], len - i);
+				i = len;
+				break;
+			}
+			rv = pending_append(parser, &chunk[i], end - i);
+			if (rv >= 0) {
+				rv = push_string(parser, parser->pending, parser->pending_len);
+			}
+			parser->pending_len = 0;
+			i = end + 1;
+			break;
+		case PARSER_SCALAR:
+			end = scalar_end(chunk, i, len);
+			rv = pending_append(parser, &chunk[i], end - i);
+			if (rv >= 0 && end < len) {
+				rv = push_scalar(parser, parser->pending, parser->pending_len);
+				parser->pending_len = 0;
+			}
+			i = end;
+			break;
+		case PARSER_DONE:
+			// Only whitespace may follow the document
+			if (!is_space(chunk[i])) {
+				rv = -1;
+			}
+			i++;
+			break;
+		case PARSER_ERROR:
+			rv = -1;
+			break;
+		}
+	}
+
+	if (rv < 0) {
+		parser->state = PARSER_ERROR;
+	}
+	return rv;
+}
+
+int
+nson_json_parser_finish(NsonJsonParser *parser, Nson *nson) {
+	int rv = 0;
+
+	memset(nson, 0, sizeof(*nson));
+	if (parser->state == PARSER_SCALAR) {
+		rv = push_scalar(parser, parser->pending, parser->pending_len);
+	} else if (parser->state != PARSER_DONE) {
+		rv = -1;
+	}
+	if (rv >= 0) {
+		rv = __nson_builder_finish(&parser->builder, nson);
+	}
+
+	nson_json_parser_clean(parser);
+	return rv;
+}
+
+void
+nson_json_parser_clean(NsonJsonParser *parser) {
+	__nson_builder_clean(&parser->builder);
+	free(parser->pending);
+	memset(parser, 0, sizeof(*parser));
+	parser->state = PARSER_ERROR;
+}
@@ -0,0 +1,412 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <string.h>
+
+/*
+ * Projection parsing: all JSON Pointers (RFC 6901) are resolved in a single
+ * walk of the document. Each pointer is followed by a cursor, the cursors
+ * that are still looking for a member or an element of a container are
+ * matched against its children while they are skipped. Objects are read
+ * to their end, as a later duplicate key replaces an earlier match, arrays
+ * are left once every cursor found its element. Only the selected values
+ * are parsed.
+ */
+
+typedef struct JsonCursor {
+	/* remaining part of the pointer */
+	const char *pointer;
+	/* position of the selected value in the result */
+	size_t slot;
+	/* decoded reference token */
+	char *token;
+	size_t token_len;
+	/* the token as an array index */
+	size_t index;
+	/* offset of the value of the last matching member, 0 if none */
+	size_t match;
+} JsonCursor;
+
+typedef struct JsonSelector {
+	Nson *result;
+	bool *found;
+	/* unescaped object key */
+	char *key;
+	size_t key_cap;
+} JsonSelector;
+
+static int select_value(
+		JsonSelector *sel, const char *doc, size_t len, size_t i,
+		JsonCursor **cursors, size_t n);
+
+static size_t
+skip_space(const char *doc, size_t len, size_t i) {
+	for (; i < len; i++) {
+		switch (doc[i]) {
+		case ' ':
+		case '\n':
+		case '\r':
+		case '\t':
+		case '\f':
+		case '\v':
+			break;
+		default:
+			return i;
+		}
+	}
+	return i;
+}
+
+/*
+ * Decodes the reference token that follows the '/' at the start of the
+ * pointer of @p cur into @p cur->token.
+ */
+static void
+next_token(JsonCursor *cur) {
+	size_t i;
+	const char *pointer = cur->pointer + 1;
+	char *dest = cur->token;
+
+	for (i = 0; pointer[i] && pointer[i] != '/'; i++) {
+		if (pointer[i] == '~' && pointer[i + 1] == '0') {
+			*dest++ = '~';
+			i++;
+		} else if (pointer[i] == '~' && pointer[i + 1] == '1') {
+			*dest++ = '/';
+			i++;
+		} else {
+			*dest++ = pointer[i];
+		}
+	}
+	cur->token_len = dest - cur->token;
+	cur->pointer = &pointer[i];
+}
+
+/*
+ * Parses the token of @p cur as an array index.
+ *
+ * @return false if the token is not a valid index
+ */
+static bool
+token_index(JsonCursor *cur) {
+	size_t j;
+
+	cur->index = 0;
+	if (cur->token_len == 0 ||
+		(cur->token[0] == '0' && cur->token_len > 1)) {
+		return false;
+	}
+	for (j = 0; j < cur->token_len; j++) {
+		if (cur->token[j] < '0' || cur->token[j] > '9' ||
+			cur->index > (SIZE_MAX - 9) / 10) {
+			return false;
+		}
+		cur->index = cur->index * 10 + cur->token[j] - '0';
+	}
+	return true;
+}
+
+/*
+ * @return the unescaped form of the object key @p key or NULL on error
+ */
+static const char *
+member_key(JsonSelector *sel, const char *key, size_t *len) {
+	char *buf;
+
+	if (memchr(key, '\\', *len) == NULL) {
+		return key;
+	}
+	if (*len > sel->key_cap) {
+		buf = realloc(sel->key, *len);
+		if (buf == NULL) {
+			return NULL;
+		}
+		sel->key = buf;
+		sel->key_cap = *len;
+	}
+	*len = __nson_json_unescape(sel->key, key, *len);
+	return sel->key;
+}
+
+static void
+swap_cursors(JsonCursor **cursors, size_t a, size_t b) {
+	JsonCursor *tmp = cursors[a];
+
+	cursors[a] = cursors[b];
+	cursors[b] = tmp;
+}
+
+/*
+ * Steps through the members of the object at @p i and follows the
+ * cursors whose token names a member into its value. If a key appears
+ * more than once, the last member is selected, like nson_obj_get() does.
+ *
+ * @return 0 on success or -1 on malformed input
+ */
+static int
+select_members(
+		JsonSelector *sel, const char *doc, size_t len, size_t i,
+		JsonCursor **cursors, size_t n) {
+	off_t end;
+	size_t k, m, key_len, match;
+	const char *key;
+
+	for (k = 0; k < n; k++) {
+		cursors[k]->match = 0;
+	}
+	for (i = skip_space(doc, len, i + 1); i < len && doc[i] != '}';) {
+		end = __nson_json_string_end(doc, len, i);
+		if (doc[i] != '"' || end < 0) {
+			return -1;
+		}
+		key_len = end - i - 1;
+		key = member_key(sel, &doc[i + 1], &key_len);
+		if (key == NULL) {
+			return -1;
+		}
+
+		i = skip_space(doc, len, end + 1);
+		if (i >= len || doc[i] != ':') {
+			return -1;
+		}
+		i = skip_space(doc, len, i + 1);
+		if (i >= len) {
+			return -1;
+		}
+		// a later member with the same key replaces the match
+		for (k = 0; k < n; k++) {
+			if (cursors[k]->token_len == key_len &&
+				memcmp(cursors[k]->token, key, key_len) == 0) {
+				cursors[k]->match = i;
+			}
+		}
+
+		end = __nson_json_value_end(doc, len, i);
+		if (end < 0) {
+			return -1;
+		}
+		i = skip_space(doc, len, end);
+		if (i < len && doc[i] == ',') {
+			i = skip_space(doc, len, i + 1);
+		} else if (i >= len || doc[i] != '}') {
+			return -1;
+		}
+	}
+	if (i >= len) {
+		return -1;
+	}
+
+	// cursors matching the same member are followed into it together
+	while (n > 0) {
+		match = cursors[0]->match;
+		if (match == 0) {
+			swap_cursors(cursors, 0, --n);
+			continue;
+		}
+		for (k = 0, m = n; k < m;) {
+			if (cursors[k]->match == match) {
+				swap_cursors(cursors, k, --m);
+			} else {
+				k++;
+			}
+		}
+		if (select_value(sel, doc, len, match, &cursors[m], n - m) < 0) {
+			return -1;
+		}
+		n = m;
+	}
+	return 0;
+}
+
+/*
+ * Steps through the elements of the array at @p i and follows the cursors
+ * whose token is the index of an element into it.
+ *
+ * @return 0 on success or -1 on malformed input
+ */
+static int
+select_elements(
+		JsonSelector *sel, const char *doc, size_t len, size_t i,
+		JsonCursor **cursors, size_t n) {
+	off_t end;
+	size_t k, m, pos;
+
+	// cursors without a valid index select nothing
+	for (k = 0; k < n;) {
+		if (token_index(cursors[k])) {
+			k++;
+		} else {
+			swap_cursors(cursors, k, --n);
+		}
+	}
+
+	i = skip_space(doc, len, i + 1);
+	for (pos = 0; n > 0 && i < len && doc[i] != ']'; pos++) {
+		for (k = 0, m = n; k < m;) {
+			if (cursors[k]->index == pos) {
+				swap_cursors(cursors, k, --m);
+			} else {
+				k++;
+			}
+		}
+		if (m < n) {
+			if (select_value(sel, doc, len, i, &cursors[m], n - m) < 0) {
+				return -1;
+			}
+			n = m;
+			if (n == 0) {
+				return 0;
+			}
+		}
+
+		end = __nson_json_value_end(doc, len, i);
+		if (end < 0) {
+			return -1;
+		}
+		i = skip_space(doc, len, end);
+		if (i < len && doc[i] == ',') {
+			i = skip_space(doc, len, i + 1);
+		} else if (i >= len || doc[i] != ']') {
+			return -1;
+		}
+	}
+	return n == 0 || i < len ? 0 : -1;
+}
+
+/*
+ * Resolves @p cursors at the value at @p i. Cursors whose pointer ends
+ * here select the value, the others continue with its children.
+ *
+ * @return 0 on success or -1 on malformed input
+ */
+static int
+select_value(
+		JsonSelector *sel, const char *doc, size_t len, size_t i,
+		JsonCursor **cursors, size_t n) {
+	size_t k;
+	JsonCursor *cur;
+
+	if (i >= len) {
+		return -1;
+	}
+	for (k = 0; k < n;) {
+		cur = cursors[k];
+		if (*cur->pointer != '\0') {
+			next_token(cur);
+			k++;
+			continue;
+		}
+		if (nson_parse_json(&sel->result[cur->slot], &doc[i], len - i) < 0) {
+			return -1;
+		}
+		if (sel->found) {
+			sel->found[cur->slot] = true;
+		}
+		swap_cursors(cursors, k, --n);
+	}
+
+	if (n == 0) {
+		return 0;
+	} else if (doc[i] == '{') {
+		return select_members(sel, doc, len, i, cursors, n);
+	} else if (doc[i] == '[') {
+		return select_elements(sel, doc, len, i, cursors, n);
+	}
+	// scalars have no children
+	return 0;
+}
+
+int
+nson_parse_json_select(
+		Nson *nson, const char *doc, size_t len, const char **pointers,
+		size_t n, bool *found) {
+	int rv = 0;
+	size_t i, tokens_len = 0;
+	Nson value = {0};
+	char *tokens = NULL;
+	JsonCursor *cursors = NULL, **list = NULL;
+	JsonSelector sel = {.found = found};
+
+	nson_init_arr(nson);
+	if (found) {
+		memset(found, 0, n * sizeof(*found));
+	}
+	for (i = 0; i < n; i++) {
+		if (*pointers[i] != '\0' && *pointers[i] != '/') {
+			// only absolute pointers are supported
+			rv = -1;
+			goto out;
+		}
+		tokens_len += strlen(pointers[i]) + 1;
+	}
+	if (nson_arr_reserve(nson, n) < 0) {
+		rv = -1;
+		goto out;
+	}
+	// values that do not exist are NSON_NIL
+	for (i = 0; i < n; i++) {
+		nson_arr_push(nson, &value);
+	}
+	if (n == 0) {
+		goto out;
+	}
+
+	cursors = calloc(n, sizeof(*cursors));
+	list = calloc(n, sizeof(*list));
+	tokens = malloc(tokens_len);
+	if (cursors == NULL || list == NULL || tokens == NULL) {
+		rv = -1;
+		goto out;
+	}
+	for (i = 0, tokens_len = 0; i < n; i++) {
+		cursors[i].pointer = pointers[i];
+		cursors[i].slot = i;
+		cursors[i].token = &tokens[tokens_len];
+		tokens_len += strlen(pointers[i]) + 1;
+		list[i] = &cursors[i];
+	}
+
+	sel.result = nson_arr_get(nson, 0);
+	rv = select_value(&sel, doc, len, skip_space(doc, len, 0), list, n);
+
+out:
+	if (rv < 0) {
+		nson_clean(nson);
+		if (found) {
+			memset(found, 0, n * sizeof(*found));
+		}
+	}
+	free(cursors);
+	free(list);
+	free(tokens);
+	free(sel.key);
+	return rv < 0 ? -1 : 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+/*
+ * A document whose root is an array is split between its elements. The
+ * split points are found by a pre-scan that tracks the nesting depth and
+ * steps over strings, so brackets and commas inside of them are never
+ * taken for split points. The chunks are then parsed concurrently and
+ * concatenated in order.
+ */
+
+#define CHUNKS_PER_THREAD 4
+
+struct JsonChunk {
+	const char *doc;
+	size_t len;
+	Nson array;
+	int rv;
+};
+
+struct JsonChunkThread {
+	struct JsonChunk *chunks;
+	size_t len;
+	size_t start;
+	pthread_t thread;
+	bool started;
+	pthread_mutex_t *lock;
+	size_t *reserved;
+};
+
+static int
+push_split(size_t **splits, size_t *len, size_t *cap, size_t offset) {
+	size_t *new_splits;
+
+	if (*len == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		new_splits = realloc(*splits, *cap * sizeof(**splits));
+		if (new_splits == NULL) {
+			return -1;
+		}
+		*splits = new_splits;
+	}
+	(*splits)[(*len)++] = offset;
+	return 0;
+}
+
+/*
+ * Collects the offsets of the opening bracket, of the top level commas
+ * that are at least @p target bytes apart and of the closing bracket of
+ * the root array. The pre-scan runs on a single thread, so validation is
+ * left to the parsers of the chunks.
+ *
+ * @return the end of the root array, 0 if the root is not an array or
+ * < 0 on error
+ */
+static off_t
+find_splits(
+		size_t **splits, size_t *splits_len, const char *doc, size_t len,
+		size_t target) {
+	off_t end;
+	size_t i, depth = 1, last, cap = 0;
+
+	*splits = NULL;
+	*splits_len = 0;
+
+	for (i = 0; i < len && memchr(" \t\n\r\f\v", doc[i], 6); i++)
+		;
+	if (i >= len || doc[i] != '[') {
+		return 0;
+	}
+	last = i;
+	if (push_split(splits, splits_len, &cap, i) < 0) {
+		return -1;
+	}
+
+	for (i++; i < len; i++) {
+		switch (doc[i]) {
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case ']':
+		case '}':
+			if (--depth > 0) {
+				break;
+			} else if (doc[i] != ']') {
+				// nested brackets are matched by the parsers of the chunks
+				return -1;
+			}
+			return push_split(splits, splits_len, &cap, i) < 0 ? -1 : i + 1;
+		case '"':
+			end = __nson_json_string_end(doc, len, i);
+			if (end < 0) {
+				return -1;
+			}
+			i = end;
+			break;
+		case ',':
+			if (depth == 1 && i - last >= target) {
+				if (push_split(splits, splits_len, &cap, i) < 0) {
+					return -1;
+				}
+				last = i;
+			}
+			break;
+		}
+	}
+
+	// Premature EOF
+	return -1;
+}
+
+static void *
+chunk_thread_wrapper(void *arg) {
+	size_t i;
+	struct JsonChunk *chunk;
+	struct JsonChunkThread *thread = arg;
+
+	i = thread->start;
+	while (i < thread->len) {
+		chunk = &thread->chunks[i];
+		chunk->rv = __nson_parse_json_elements(
+				&chunk->array, chunk->doc, chunk->len);
+
+		pthread_mutex_lock(thread->lock);
+		i = (*thread->reserved)++;
+		pthread_mutex_unlock(thread->lock);
+	}
+
+	return NULL;
+}
+
+static void
+parse_chunks(int thread_count, struct JsonChunk *chunks, size_t len) {
+	int i;
+	struct JsonChunkThread *threads;
+	pthread_mutex_t lock;
+	size_t reserved;
+
+	threads = alloca(thread_count * sizeof(*threads));
+	pthread_mutex_init(&lock, NULL);
+
+	reserved = thread_count;
+	for (i = 0; i < thread_count; i++) {
+		threads[i].chunks = chunks;
+		threads[i].len = len;
+		threads[i].start = i;
+		threads[i].lock = &lock;
+		threads[i].reserved = &reserved;
+		threads[i].started = false;
+
+		if (i < thread_count - 1) {
+			threads[i].started =
+					pthread_create(
+							&threads[i].thread, NULL, chunk_thread_wrapper,
+							&threads[i]) == 0;
+		}
+		if (!threads[i].started) {
+			// The calling thread takes over the chunks of failed threads
+			chunk_thread_wrapper(&threads[i]);
+		}
+	}
+
+	for (i = 0; i < thread_count - 1; i++) {
+		if (threads[i].started) {
+			pthread_join(threads[i].thread, NULL);
+		}
+	}
+
+	pthread_mutex_destroy(&lock);
+}
+
+static int
+concat_chunks(Nson *nson, struct JsonChunk *chunks, size_t len) {
+	size_t i, total = 0;
+
+	for (i = 0; i < len; i++) {
+		total += nson_arr_len(&chunks[i].array);
+	}
+	if (nson_arr_reserve(&chunks[0].array, total) < 0) {
+		return -1;
+	}
+	for (i = 1; i < len; i++) {
+		if (nson_arr_concat(&chunks[0].array, &chunks[i].array) < 0) {
+			return -1;
+		}
+	}
+	nson_move(nson, &chunks[0].array);
+	return 0;
+}
+
+int
+nson_parse_json_thread_ext(
+		const NsonThreadMapSettings *settings, Nson *nson, const char *doc,
+		size_t len) {
+	off_t rv = 0;
+	size_t i, target, splits_len = 0, chunks_len = 0;
+	size_t *splits = NULL;
+	struct JsonChunk *chunks = NULL;
+	const int thread_count = settings->threads > 1 ? settings->threads : 1;
+
+	memset(nson, 0, sizeof(*nson));
+
+	target = settings->chunk_size > 0
+			? (size_t)settings->chunk_size
+			: len / thread_count / CHUNKS_PER_THREAD;
+	rv = find_splits(&splits, &splits_len, doc, len, target);
+	if (rv < 0) {
+		goto out;
+	} else if (rv == 0 || splits_len < 3 || thread_count == 1) {
+		// Not worth splitting
+		free(splits);
+		return nson_parse_json(nson, doc, len);
+	}
+
+	chunks_len = splits_len - 1;
+	chunks = calloc(chunks_len, sizeof(*chunks));
+	if (chunks == NULL) {
+		rv = -1;
+		goto out;
+	}
+	for (i = 0; i < chunks_len; i++) {
+		chunks[i].doc = &doc[splits[i] + 1];
+		chunks[i].len = splits[i + 1] - splits[i] - 1;
+	}
+
+	parse_chunks(
+			chunks_len < (size_t)thread_count ? (int)chunks_len : thread_count,
+			chunks, chunks_len);
+
+	for (i = 0; i < chunks_len; i++) {
+		if (chunks[i].rv < 0) {
+			rv = -1;
+			goto out;
+		}
+	}
+	if (concat_chunks(nson, chunks, chunks_len) < 0) {
+		rv = -1;
+	}
+
+out:
+	for (i = 0; i < chunks_len; i++) {
+		nson_clean(&chunks[i].array);
+	}
+	free(chunks);
+	free(splits);
+	// the byte count of documents beyond 2GB does not fit into the result
+	return rv > INT_MAX ? INT_MAX : rv;
+}
+
+int
+nson_parse_json_thread(Nson *nson, const char *doc, size_t len) {
+	NsonThreadMapSettings settings = {
+			.threads = get_nprocs(),
+			.chunk_size = 0,
+	};
+
+	return nson_parse_json_thread_ext(&settings, nson, doc, len);
+}
+
+int
+nson_load_json_thread(Nson *nson, const char *file) {
+	return nson_load(nson_parse_json_thread, nson, file);
+}
@@ -0,0 +1,337 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <ctype.h>
+#include <string.h>
+
+/*
+ * The validator walks the offsets of the structural scanner with a strict
+ * JSON state machine. Open containers are tracked in a fixed bit stack, so
+ * validation never allocates.
+ */
+
+#define VALIDATE_MAX_DEPTH 1024
+
+enum ValidateState {
+	EXPECT_VALUE,
+	EXPECT_VALUE_OR_CLOSE,
+	EXPECT_KEY,
+	EXPECT_KEY_OR_CLOSE,
+	EXPECT_COLON,
+	EXPECT_COMMA_OR_CLOSE,
+	EXPECT_END,
+};
+
+typedef struct Validator {
+	const char *doc;
+	size_t len;
+	enum ValidateState state;
+	size_t depth;
+	/* a set bit marks an object */
+	uint64_t objects[VALIDATE_MAX_DEPTH / 64];
+	NsonError *err;
+} Validator;
+
+static int
+fail(Validator *v, size_t offset, const char *message) {
+	if (v->err) {
+		v->err->offset = offset;
+		v->err->message = message;
+	}
+	return -1;
+}
+
+static bool
+is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static bool
+top_is_object(const Validator *v) {
+	const size_t i = v->depth - 1;
+	return v->objects[i / 64] & (1ULL << (i % 64));
+}
+
+static void
+value_done(Validator *v) {
+	v->state = v->depth == 0 ? EXPECT_END : EXPECT_COMMA_OR_CLOSE;
+}
+
+static bool
+expects_value(const Validator *v) {
+	return v->state == EXPECT_VALUE || v->state == EXPECT_VALUE_OR_CLOSE;
+}
+
+static int
+open_container(Validator *v, size_t i, bool object) {
+	const size_t depth = v->depth;
+
+	if (!expects_value(v)) {
+		return fail(v, i, "unexpected container");
+	} else if (depth == VALIDATE_MAX_DEPTH) {
+		return fail(v, i, "nesting too deep");
+	}
+	if (object) {
+		v->objects[depth / 64] |= 1ULL << (depth % 64);
+	} else {
+		v->objects[depth / 64] &= ~(1ULL << (depth % 64));
+	}
+	v->depth++;
+	v->state = object ? EXPECT_KEY_OR_CLOSE : EXPECT_VALUE_OR_CLOSE;
+	return 0;
+}
+
+static int
+close_container(Validator *v, size_t i, bool object) {
+	const bool empty = object ? v->state == EXPECT_KEY_OR_CLOSE
+							  : v->state == EXPECT_VALUE_OR_CLOSE;
+
+	if (v->depth == 0 || top_is_object(v) != object ||
+		(!empty && v->state != EXPECT_COMMA_OR_CLOSE)) {
+		return fail(v, i, "unexpected closing bracket");
+	}
+	v->depth--;
+	value_done(v);
+	return 0;
+}
+
+static int
+validate_string(Validator *v, size_t start, size_t end) {
+	size_t i, j;
+	const char *doc = v->doc;
+
+	for (i = start + 1; i < end; i++) {
+		i += __nson_escape_span(&doc[i], end - i, NSON_ESCAPE_JSON);
+		if (i == end) {
+			break;
+		} else if (doc[i] != '\\') {
+			return fail(v, i, "control character in string");
+		}
+		switch (doc[++i]) {
+		case '"':
+		case '\\':
+		case '/':
+		case 'b':
+		case 'f':
+		case 'n':
+		case 'r':
+		case 't':
+			break;
+		case 'u':
+			for (j = 1; j <= 4; j++) {
+				if (i + j >= end || !isxdigit((uint8_t)doc[i + j])) {
+					return fail(v, i, "invalid unicode escape");
+				}
+			}
+			i += 4;
+			break;
+		default:
+			return fail(v, i, "invalid escape sequence");
+		}
+	}
+	return 0;
+}
+
+static size_t
+skip_digits(const char *doc, size_t len, size_t i) {
+	for (; i < len && doc[i] >= '0' && doc[i] <= '9'; i++)
+		;
+	return i;
+}
+
+/*
+ * @return the end of the number at @p i or @p i if it is not a valid
+ * JSON number
+ */
+static size_t
+number_end(const char *doc, size_t len, size_t i) {
+	size_t start = i, end;
+
+	if (i < len && doc[i] == '-') {
+		i++;
+	}
+	if (i < len && doc[i] == '0') {
+		i++;
+	} else if ((end = skip_digits(doc, len, i)) > i) {
+		i = end;
+	} else {
+		return start;
+	}
+	if (i < len && doc[i] == '.') {
+		if ((end = skip_digits(doc, len, i + 1)) == i + 1) {
+			return start;
+		}
+		i = end;
+	}
+	if (i < len && (doc[i] == 'e' || doc[i] == 'E')) {
+		i++;
+		if (i < len && (doc[i] == '+' || doc[i] == '-')) {
+			i++;
+		}
+		if ((end = skip_digits(doc, len, i)) == i) {
+			return start;
+		}
+		i = end;
+	}
+	return i;
+}
+
+static off_t
+validate_scalar(Validator *v, size_t i) {
+	size_t end = i;
+	const char *doc = v->doc;
+	const size_t len = v->len;
+
+	if (!expects_value(v)) {
+		return fail(v, i, "unexpected value");
+	}
+	if (len - i >= 4 && memcmp(&doc[i], "null", 4) == 0) {
+		end = i + 4;
+	} else if (len - i >= 4 && memcmp(&doc[i], "true", 4) == 0) {
+		end = i + 4;
+	} else if (len - i >= 5 && memcmp(&doc[i], "false", 5) == 0) {
+		end = i + 5;
+	} else {
+		end = number_end(doc, len, i);
+	}
+	if (end == i || (end < len && !__nson_json_delimiter(doc[end]))) {
+		return fail(v, i, "invalid value");
+	}
+	value_done(v);
+	return end;
+}
+
+/*
+ * @return the end of the token at @p i or < 0 if it is invalid
+ */
+static off_t
+validate_token(Validator *v, NsonScanner *scan, size_t i) {
+	int rv = 0;
+	off_t end;
+
+	switch (v->doc[i]) {
+	case '{':
+		rv = open_container(v, i, true);
+		break;
+	case '[':
+		rv = open_container(v, i, false);
+		break;
+	case '}':
+		rv = close_container(v, i, true);
+		break;
+	case ']':
+		rv = close_container(v, i, false);
+		break;
+	case ',':
+		if (v->state != EXPECT_COMMA_OR_CLOSE) {
+			return fail(v, i, "unexpected comma");
+		}
+		v->state = top_is_object(v) ? EXPECT_KEY : EXPECT_VALUE;
+		break;
+	case ':':
+		if (v->state != EXPECT_COLON) {
+			return fail(v, i, "unexpected colon");
+		}
+		v->state = EXPECT_VALUE;
+		break;
+	case '"':
+		end = __nson_scan_next(scan);
+		if (end < 0) {
+			return fail(v, i, "unterminated string");
+		} else if (validate_string(v, i, end) < 0) {
+			return -1;
+		}
+		if (v->state == EXPECT_KEY || v->state == EXPECT_KEY_OR_CLOSE) {
+			v->state = EXPECT_COLON;
+		} else if (expects_value(v)) {
+			value_done(v);
+		} else {
+			return fail(v, i, "unexpected string");
+		}
+		return end + 1;
+	default:
+		return validate_scalar(v, i);
+	}
+	return rv < 0 ? rv : (off_t)i + 1;
+}
+
+/*
+ * The scanner also skips \f and \v, which JSON does not allow between
+ * tokens.
+ */
+static int
+validate_space(Validator *v, size_t start, size_t end) {
+	size_t i;
+
+	for (i = start; i < end; i++) {
+		if (!is_space(v->doc[i])) {
+			return fail(v, i, "unexpected character");
+		}
+	}
+	return 0;
+}
+
+int
+nson_json_validate(const char *doc, size_t len, NsonError *err) {
+	off_t i, end = 0;
+	size_t j;
+	NsonScanner scan;
+	Validator v = {
+			.doc = doc,
+			.len = len,
+			.state = EXPECT_VALUE,
+			.err = err,
+	};
+
+	j = __nson_utf8_valid(doc, len);
+	if (j != len) {
+		return fail(&v, j, "invalid UTF-8");
+	}
+
+	__nson_scan_init(&scan, doc, len);
+	while ((i = __nson_scan_next(&scan)) >= 0) {
+		if (v.state == EXPECT_END) {
+			return fail(&v, i, "trailing characters");
+		} else if (validate_space(&v, end, i) < 0) {
+			return -1;
+		}
+		end = validate_token(&v, &scan, i);
+		if (end < 0) {
+			return -1;
+		}
+	}
+	if (validate_space(&v, end, len) < 0) {
+		return -1;
+	} else if (v.state != EXPECT_END) {
+		return fail(&v, len, "unexpected end of document");
+	}
+	return 0;
+}
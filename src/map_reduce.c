@@ -88,53 +88,26 @@ nson_mapper_b64_dec(off_t index, Nson *nson, void *user_data) {
 		return -1;
 	}
 
-	__nson_buf_release(nson->d.buf);
-	nson->d.buf = dest_buf;
-	__nson_buf_shrink(nson->d.buf, j);
+	__nson_buf_shrink(dest_buf, j);
+	__nson_data_replace(nson, dest_buf);
 
 	return i;
 }
 
 int
 nson_mapper_b64_enc(off_t index, Nson *nson, void *user_data) {
-	off_t i, j;
-	char *dest;
 	NsonBuf *dest_buf;
-	int reminder = 0;
-	static const char mask = (1 << 6) - 1;
 	assert(nson_type(nson) == NSON_STR || nson_type(nson) == NSON_BLOB);
 
 	const size_t src_len = nson_data_len(nson);
 	const char *src = nson_data(nson);
 
 	dest_buf = __nson_buf_new((src_len + 2) / 3 * 4);
-	dest = __nson_buf(dest_buf);
-	if (!dest)
+	if (dest_buf == NULL)
 		return -1;
 
-	for (j = i = 0; i < src_len; i++, j++) {
-		switch (i % 3) {
-		case 0:
-			dest[j] = base64_table[(src[i] >> 2) & mask];
-			reminder = (src[i] << 4) & mask;
-			break;
-		case 1:
-			dest[j] = base64_table[(src[i] >> 4 | reminder) & mask];
-			reminder = (src[i] << 2) & mask;
-			break;
-		case 2:
-			dest[j++] = base64_table[(src[i] >> 6 | reminder) & mask];
-			dest[j] = base64_table[src[i] & mask];
-			break;
-		}
-	}
-	if (__nson_buf_siz(dest_buf) != j) {
-		dest[j] = base64_table[reminder & mask];
-		memset(&dest[j + 1], '=', __nson_buf_siz(dest_buf) - j - 1);
-	}
-
-	__nson_buf_release(nson->d.buf);
-	nson->d.buf = dest_buf;
+	__nson_format_b64(__nson_buf(dest_buf), src, src_len);
+	__nson_data_replace(nson, dest_buf);
 
 	return __nson_buf_siz(dest_buf);
 }
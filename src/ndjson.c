@@ -0,0 +1,300 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+/*
+ * Newline delimited JSON: every non-blank line holds one document. The
+ * input is split into lines first, the lines are then parsed by a pool
+ * of threads and collected into an array in input order.
+ */
+
+struct NdjsonLine {
+	const char *doc;
+	size_t len;
+	size_t line;
+	int rv;
+};
+
+struct NdjsonThread {
+	struct NdjsonLine *lines;
+	Nson *values;
+	size_t len;
+	size_t start;
+	size_t chunk_size;
+	pthread_t thread;
+	bool started;
+	pthread_mutex_t *lock;
+	size_t *reserved;
+};
+
+static bool
+is_blank(const char *doc, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		switch (doc[i]) {
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\f':
+		case '\v':
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+static int
+split_lines(
+		struct NdjsonLine **lines, size_t *len, const char *doc,
+		size_t doc_len) {
+	size_t cap = 0, line = 0, line_len;
+	const char *end = doc + doc_len, *nl;
+	struct NdjsonLine *new_lines;
+
+	*lines = NULL;
+	*len = 0;
+	while (doc < end) {
+		line++;
+		nl = memchr(doc, '\n', end - doc);
+		line_len = (nl ? nl : end) - doc;
+		if (!is_blank(doc, line_len)) {
+			if (*len == cap) {
+				cap = cap ? cap * 2 : 64;
+				new_lines = realloc(*lines, cap * sizeof(**lines));
+				if (new_lines == NULL) {
+					free(*lines);
+					*lines = NULL;
+					return -1;
+				}
+				*lines = new_lines;
+			}
+			(*lines)[*len].doc = doc;
+			(*lines)[*len].len = line_len;
+			(*lines)[*len].line = line;
+			(*len)++;
+		}
+		doc += line_len + 1;
+	}
+	return 0;
+}
+
+static int
+parse_line(Nson *nson, const char *doc, size_t len) {
+	int rv = nson_parse_json(nson, doc, len);
+
+	if (rv < 0) {
+		return -1;
+	} else if (!is_blank(&doc[rv], len - rv)) {
+		// A line must not hold more than one document
+		nson_clean(nson);
+		memset(nson, 0, sizeof(*nson));
+		return -1;
+	}
+	return 0;
+}
+
+static void *
+ndjson_thread_wrapper(void *arg) {
+	size_t i, end;
+	struct NdjsonThread *thread = arg;
+
+	i = thread->start;
+	end = i + thread->chunk_size;
+	do {
+		for (; i < end && i < thread->len; i++) {
+			thread->lines[i].rv = parse_line(
+					&thread->values[i], thread->lines[i].doc,
+					thread->lines[i].len);
+		}
+		pthread_mutex_lock(thread->lock);
+		i = *thread->reserved;
+		end = i + thread->chunk_size;
+		*thread->reserved = end;
+		pthread_mutex_unlock(thread->lock);
+	} while (i < thread->len);
+
+	return NULL;
+}
+
+static void
+parse_lines(
+		NsonThreadMapSettings *settings, struct NdjsonLine *lines,
+		Nson *values, size_t len) {
+	int i;
+	struct NdjsonThread *threads;
+	pthread_mutex_t lock;
+	size_t reserved;
+
+	threads = alloca(settings->threads * sizeof(*threads));
+	pthread_mutex_init(&lock, NULL);
+
+	reserved = settings->threads * settings->chunk_size;
+	for (i = 0; i < settings->threads; i++) {
+		threads[i].lines = lines;
+		threads[i].values = values;
+		threads[i].len = len;
+		threads[i].start = i * settings->chunk_size;
+		threads[i].chunk_size = settings->chunk_size;
+		threads[i].lock = &lock;
+		threads[i].reserved = &reserved;
+
+		threads[i].started = false;
+
+		if (i < settings->threads - 1) {
+			threads[i].started =
+					pthread_create(
+							&threads[i].thread, NULL, ndjson_thread_wrapper,
+							&threads[i]) == 0;
+		}
+		if (!threads[i].started) {
+			// The calling thread takes over the lines of failed threads
+			ndjson_thread_wrapper(&threads[i]);
+		}
+	}
+
+	for (i = 0; i < settings->threads - 1; i++) {
+		if (threads[i].started) {
+			pthread_join(threads[i].thread, NULL);
+		}
+	}
+
+	pthread_mutex_destroy(&lock);
+}
+
+static int
+collect_errors(Nson *errors, const struct NdjsonLine *lines, size_t len) {
+	size_t i;
+	Nson line;
+
+	if (nson_init_arr(errors) < 0) {
+		return -1;
+	}
+	for (i = 0; i < len; i++) {
+		if (lines[i].rv >= 0) {
+			continue;
+		}
+		nson_int_wrap(&line, lines[i].line);
+		if (nson_arr_push(errors, &line) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+nson_parse_ndjson_ext(
+		const NsonThreadMapSettings *settings, Nson *nson, Nson *errors,
+		const char *doc, size_t len) {
+	int rv = 0;
+	size_t i, j, lines_len = 0;
+	struct NdjsonLine *lines = NULL;
+	Nson *values = NULL;
+	NsonThreadMapSettings pool = {
+			.threads = get_nprocs(),
+			.chunk_size = 64,
+	};
+
+	memset(nson, 0, sizeof(*nson));
+	if (errors) {
+		memset(errors, 0, sizeof(*errors));
+	}
+
+	rv = split_lines(&lines, &lines_len, doc, len);
+	if (rv < 0) {
+		goto out;
+	}
+	values = calloc(lines_len ? lines_len : 1, sizeof(*values));
+	if (values == NULL) {
+		rv = -1;
+		goto out;
+	}
+
+	if (settings) {
+		pool = *settings;
+	}
+	if (pool.threads < 1) {
+		pool.threads = 1;
+	}
+	if (pool.chunk_size < 1) {
+		pool.chunk_size = 1;
+	}
+	if ((size_t)pool.threads * pool.chunk_size > lines_len) {
+		pool.threads = lines_len / pool.chunk_size + 1;
+	}
+	parse_lines(&pool, lines, values, lines_len);
+
+	// Close the gaps of the lines that failed to parse
+	for (i = j = 0; i < lines_len; i++) {
+		if (lines[i].rv >= 0) {
+			values[j++] = values[i];
+		} else if (errors == NULL) {
+			rv = -1;
+		}
+	}
+	if (rv >= 0 && errors) {
+		rv = collect_errors(errors, lines, lines_len);
+	}
+	if (rv >= 0) {
+		rv = __nson_arr_init_move(nson, values, j, NULL);
+	}
+	if (rv < 0) {
+		for (i = 0; i < j; i++) {
+			nson_clean(&values[i]);
+		}
+		nson_clean(nson);
+		memset(nson, 0, sizeof(*nson));
+		if (errors) {
+			nson_clean(errors);
+			memset(errors, 0, sizeof(*errors));
+		}
+	}
+
+out:
+	free(values);
+	free(lines);
+	return rv;
+}
+
+int
+nson_parse_ndjson(Nson *nson, const char *doc, size_t len) {
+	return nson_parse_ndjson_ext(NULL, nson, NULL, doc, len);
+}
+
+int
+nson_load_ndjson(Nson *nson, const char *file) {
+	return nson_load(nson_parse_ndjson, nson, file);
+}
@@ -44,7 +44,7 @@ nson_cmp(const void *a, const void *b) {
 	switch (a_type) {
 	case NSON_STR:
 	case NSON_BLOB:
-		return __nson_buf_cmp(na->d.buf, nb->d.buf);
+		return __nson_data_cmp(na, nb);
 	case NSON_REAL:
 		return SCAL_CMP(nson_real(na), nson_real(nb));
 	case NSON_INT:
@@ -55,6 +55,18 @@ nson_cmp(const void *a, const void *b) {
 	}
 }
 
+int
+nson_shrink_to_fit(Nson *nson) {
+	switch (nson_type(nson)) {
+	case NSON_ARR:
+		return __nson_arr_shrink(nson);
+	case NSON_OBJ:
+		return __nson_obj_shrink(nson);
+	default:
+		return 0;
+	}
+}
+
 int
 nson_clean(Nson *nson) {
 	int rv = 0;
@@ -62,16 +74,25 @@ nson_clean(Nson *nson) {
 	switch (nson_type(nson)) {
 	case NSON_BLOB:
 	case NSON_STR:
-		__nson_buf_release(nson->d.buf);
+		if (!(nson->c.flags & (NSON_FLAG_INLINE | NSON_FLAG_BORROWED)) &&
+			nson->d.buf) {
+			__nson_buf_release(nson->d.buf);
+		}
 		break;
 	case NSON_POINTER:
 		__nson_ptr_release(nson->p.ref);
 		break;
 	case NSON_ARR:
-		__nson_arr_clean(nson);
+		// arena containers are released together with their arena and
+		// lazy containers have not allocated anything yet
+		if (!(nson->c.flags & (NSON_FLAG_ARENA | NSON_FLAG_LAZY))) {
+			__nson_arr_clean(nson);
+		}
 		break;
 	case NSON_OBJ:
-		__nson_obj_clean(nson);
+		if (!(nson->c.flags & (NSON_FLAG_ARENA | NSON_FLAG_LAZY))) {
+			__nson_obj_clean(nson);
+		}
 		break;
 	case NSON_BOOL:
 	case NSON_INT:
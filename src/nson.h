@@ -51,6 +51,8 @@
 union Nson;
 struct NsonBuf;
 struct NsonPointerRef;
+struct NsonArenaChunk;
+struct NsonObjectIndex;
 
 /**
  * @brief function pointer that is used to parse a buffer
@@ -95,22 +97,34 @@ enum NsonType {
 enum NsonOptions {
 	NSON_IS_KEY = 1 << 1,
 	NSON_SKIP_HEADER = 1 << 2,
+	/* escape all non-ASCII characters when writing JSON */
+	NSON_ASCII = 1 << 3,
 };
 
 /**
  * @brief Information that are common to all data types
  * */
 typedef struct NsonCommon {
-	enum NsonType type;
+	/* enum NsonType, stored in a byte to keep an Nson at 16 bytes */
+	uint8_t type;
+	uint8_t flags;
 } NsonCommon;
 
 /**
  * @brief fields that are used to save arbitrary binary or
  * string data.
+ *
+ * The data is either owned through @p buf or borrowed from the source
+ * of an NsonDocument, in which case it is referenced by @p ref and
+ * @p len. Which one is used is recorded in the flags of @p c.
  */
 typedef struct NsonData {
 	struct NsonCommon c;
-	struct NsonBuf *buf;
+	uint32_t len;
+	union {
+		struct NsonBuf *buf;
+		const char *ref;
+	};
 } NsonData;
 
 /**
@@ -118,8 +132,9 @@ typedef struct NsonData {
  */
 typedef struct NsonArray {
 	struct NsonCommon c;
+	uint32_t len;
+	/* the capacity is kept in a header in front of the elements */
 	union Nson *arr;
-	size_t len;
 } NsonArray;
 
 /**
@@ -127,9 +142,10 @@ typedef struct NsonArray {
  */
 typedef struct NsonObject {
 	struct NsonCommon c;
+	uint32_t len;
+	/* capacity and lookup index are kept in a header in front of the
+	 * entries, see object.c */
 	struct NsonObjectEntry *arr;
-	bool messy;
-	size_t len;
 } NsonObject;
 
 /**
@@ -156,6 +172,30 @@ typedef struct NsonPointer {
 	struct NsonPointerRef *ref;
 } NsonPointer;
 
+/**
+ * @brief A container of a lazily parsed document that is read from
+ * @p src on first access.
+ */
+typedef struct NsonLazy {
+	struct NsonCommon c;
+	uint32_t len;
+	char *src;
+} NsonLazy;
+
+/* strings of up to NSON_INLINE_SIZE bytes are stored inside of the Nson */
+#define NSON_INLINE_SIZE 13
+
+/**
+ * @brief A short string that is stored inline without a buffer.
+ *
+ * The last byte of @p str holds NSON_INLINE_SIZE minus the length, so it
+ * doubles as the terminating zero of a string of full length.
+ */
+typedef struct NsonInline {
+	struct NsonCommon c;
+	char str[NSON_INLINE_SIZE + 1];
+} NsonInline;
+
 /**
  * @brief Data Container
  */
@@ -166,17 +206,155 @@ typedef union Nson {
 	struct NsonArray a;
 	struct NsonObject o;
 	struct NsonPointer p;
+	struct NsonLazy l;
+	struct NsonInline s;
 	struct NsonCommon c;
 } Nson;
 
 /**
  * @brief Container for an Object Entry
+ *
+ * The key is always an NSON_STR, but it is kept as a full Nson: objects
+ * take over the storage of the key value array they are built from, see
+ * nson_obj_from_arr(), so an entry has to have the layout of two values.
  */
 typedef struct NsonObjectEntry {
 	union Nson key;
 	union Nson value;
 } NsonObjectEntry;
 
+/**
+ * @brief Bump allocator that backs the tree of an NsonDocument.
+ */
+typedef struct NsonArena {
+	struct NsonArenaChunk *chunks;
+} NsonArena;
+
+/**
+ * @brief An open container of an NsonBuilder
+ */
+typedef struct NsonBuilderFrame {
+	size_t start;
+	enum NsonType type;
+} NsonBuilderFrame;
+
+/**
+ * @brief Assembles a tree from the values of a parser.
+ */
+typedef struct NsonBuilder {
+	struct NsonArena *arena;
+	union Nson *values;
+	size_t len;
+	size_t values_cap;
+	struct NsonBuilderFrame *frames;
+	size_t depth;
+	size_t frames_cap;
+} NsonBuilder;
+
+/**
+ * @brief State of an incremental JSON parser.
+ *
+ * Tokens that span the boundary of two chunks are kept in @p pending.
+ */
+typedef struct NsonJsonParser {
+	struct NsonBuilder builder;
+	char *pending;
+	size_t pending_len;
+	size_t pending_cap;
+	int state;
+	bool escaped;
+} NsonJsonParser;
+
+typedef int (*NsonWriterSink)(const char *buf, size_t len, void *user_data);
+
+/**
+ * @brief Buffered output of the serializers.
+ */
+typedef struct NsonWriter {
+	char *buf;
+	size_t len;
+	size_t cap;
+	/* NULL for writers that collect their output in memory */
+	NsonWriterSink sink;
+	void *user_data;
+	int fd;
+	bool error;
+} NsonWriter;
+
+/**
+ * @brief State of a streaming JSON emitter.
+ *
+ * The emitter must not be copied once it is initialized.
+ */
+typedef struct NsonEmitter {
+	struct NsonWriter writer;
+	enum NsonOptions options;
+	uint8_t *frames;
+	size_t depth;
+	size_t frames_cap;
+	bool done;
+} NsonEmitter;
+
+/**
+ * @brief Describes the first error found in a document.
+ */
+typedef struct NsonError {
+	size_t offset;
+	const char *message;
+} NsonError;
+
+/**
+ * @brief Callbacks of nson_parse_json_events().
+ *
+ * Strings and keys are borrowed slices of the document between the quotes
+ * with their escape sequences intact, see nson_json_unescape(). Callbacks
+ * may be NULL. A callback returning < 0 stops the parser.
+ */
+typedef struct NsonJsonEvents {
+	int (*begin_array)(void *user_data);
+	int (*end_array)(void *user_data);
+	int (*begin_object)(void *user_data);
+	int (*end_object)(void *user_data);
+	int (*key)(void *user_data, const char *str, size_t len);
+	int (*string)(void *user_data, const char *str, size_t len);
+	int (*integer)(void *user_data, int64_t value);
+	int (*real)(void *user_data, double value);
+	int (*boolean)(void *user_data, bool value);
+	int (*null)(void *user_data);
+} NsonJsonEvents;
+
+/**
+ * @brief A parsed tree together with the buffer it was parsed from.
+ *
+ * Strings of a document are decoded in place and borrow their data from
+ * the source buffer instead of copying it. The tree returned by
+ * nson_doc_root() is only valid until nson_doc_clean() is called. Use
+ * nson_clone() to get a copy that outlives the document.
+ */
+typedef struct NsonDocument {
+	union Nson root;
+	char *buf;
+	size_t len;
+	size_t mapsize;
+	void (*dtor)(void *);
+	struct NsonArena arena;
+} NsonDocument;
+
+/**
+ * @brief Memory of a parser that is reused between documents.
+ *
+ * The scratch stacks of the parser and the arena the trees are allocated
+ * from are kept when a document is done, so parsing many similar
+ * documents with the same context does not allocate memory once it has
+ * grown to their size.
+ */
+typedef struct NsonParseContext {
+	struct NsonBuilder builder;
+	uint8_t *frames;
+	size_t frames_cap;
+	struct NsonArena arena;
+} NsonParseContext;
+
 /* DATA */
 
 /**
@@ -191,6 +369,16 @@ typedef struct NsonObjectEntry {
  */
 int nson_clean(Nson *nson);
 
+/**
+ * @brief releases unused capacity of @p nson
+ *
+ * For NSON_ARR and NSON_OBJ the storage is reallocated to the number of
+ * elements. Child elements are not touched. Other types are ignored.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_shrink_to_fit(Nson *nson);
+
 /**
  * @brief returns the number of child elements of @p nson
  *
@@ -209,6 +397,21 @@ size_t nson_data_len(const Nson *nson);
 /**
  * @brief Retrieve the binary / string data from a field of type
  * NSON_STR or NSON_BLOB
+ *
+ * Strings parsed from JSON keep their escape sequences until they are
+ * first accessed by nson_data(), nson_data_len() or nson_cmp(). The
+ * first access decodes them in place, so it must not race with another
+ * access to the same string. nson_clone() decodes strings before it
+ * shares their buffers, so a clone and its source may be read
+ * concurrently.
+ *
+ * Strings of up to NSON_INLINE_SIZE bytes are stored inside of @p nson
+ * itself. The returned pointer is therefore only valid as long as @p nson
+ * stays where it is: nson_move(), nson_arr_pop() and any growth of the
+ * array or object that holds @p nson invalidate it. The same applies to
+ * the keys returned by nson_obj_get_key(). Copy the data if it has to
+ * outlive such an operation.
+ *
  * @return a pointer to the data referenced by @p nson
  */
 const char *nson_data(const Nson *nson);
@@ -328,6 +531,196 @@ int nson_real_wrap(Nson *nson, const double val);
  */
 int nson_load(NsonParser parser, Nson *nson, const char *file);
 
+/* DOCUMENT */
+
+/**
+ * @brief parses @p buf into @p doc without copying strings.
+ *
+ * @p buf is modified during parsing and must stay valid until
+ * nson_doc_clean() is called on @p doc. If @p dtor is not NULL it is
+ * called with @p buf when the document is cleaned. On error @p buf is
+ * left to the caller.
+ *
+ * @return the number of bytes parsed, < 0 on error
+ */
+int nson_doc_parse_json(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *));
+
+/**
+ * @brief parses @p buf into @p doc without copying strings.
+ *
+ * @see nson_doc_parse_json
+ */
+int nson_doc_parse_plist(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *));
+
+/**
+ * @brief maps @p file into memory and parses it into @p doc. The mapping
+ * is kept until nson_doc_clean() is called.
+ *
+ * @return the number of bytes parsed, < 0 on error
+ */
+int nson_doc_load_json(NsonDocument *doc, const char *file);
+
+/**
+ * @brief maps @p file into memory and parses it into @p doc.
+ *
+ * @see nson_doc_load_json
+ */
+int nson_doc_load_plist(NsonDocument *doc, const char *file);
+
+/**
+ * @brief indexes @p buf into @p doc without building its tree.
+ *
+ * Arrays and objects are only read from @p buf when they are first
+ * accessed, containers that are never reached are merely skipped. Errors
+ * inside of a container are detected on its first access, an invalid
+ * container reads as empty. Accessing the tree modifies it, so it must
+ * not be shared between threads until it is fully read.
+ *
+ * Every container is skipped once by each of its ancestors before it is
+ * read, so walking down n levels of nesting costs O(n * size). Deeply
+ * nested documents are better parsed eagerly. nson_clone() of a lazy
+ * container parses it in a single pass.
+ *
+ * @return the number of bytes parsed, < 0 on error
+ */
+int nson_doc_parse_json_lazy(
+		NsonDocument *doc, char *buf, size_t len, void (*dtor)(void *));
+
+/**
+ * @brief maps @p file into memory and indexes it into @p doc.
+ *
+ * @see nson_doc_parse_json_lazy
+ */
+int nson_doc_load_json_lazy(NsonDocument *doc, const char *file);
+
+/**
+ * @brief parses @p buf into @p doc allocating all nodes and strings from
+ * an arena owned by @p doc.
+ *
+ * @p buf is not modified and not referenced after this function returns.
+ * nson_doc_clean() releases the whole tree at once instead of walking it.
+ * Containers of an arena document are read only: functions that would
+ * need to reallocate them fail. Use nson_clone() to get a modifiable copy.
+ *
+ * @return the number of bytes parsed, < 0 on error
+ */
+int nson_parse_json_arena(NsonDocument *doc, const char *buf, size_t len);
+
+/**
+ * @brief parses @p buf into an arena backed @p doc.
+ *
+ * @see nson_parse_json_arena
+ */
+int nson_parse_plist_arena(NsonDocument *doc, const char *buf, size_t len);
+
+/**
+ * @brief returns the root element of @p doc
+ */
+Nson *nson_doc_root(NsonDocument *doc);
+
+/**
+ * @brief frees the tree of @p doc and releases its source buffer.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_doc_clean(NsonDocument *doc);
+
+/* PARSE CONTEXT */
+
+/**
+ * @brief initializes an empty parse context.
+ */
+void nson_parse_ctx_init(NsonParseContext *ctx);
+
+/**
+ * @brief parses @p doc into @p nson reusing the memory of @p ctx.
+ *
+ * The tree is allocated from the arena of @p ctx and is only valid until
+ * the next call with the same context or nson_parse_ctx_clean(). Like an
+ * arena document its containers are read only, nson_clone() returns a
+ * copy that outlives the context. @p doc is not referenced after this
+ * function returns.
+ *
+ * @return the number of bytes parsed, < 0 on error
+ */
+int nson_parse_json_ctx(
+		NsonParseContext *ctx, Nson *nson, const char *doc, size_t len);
+
+/**
+ * @brief frees all memory of @p ctx, including the last parsed tree.
+ */
+void nson_parse_ctx_clean(NsonParseContext *ctx);
+
+/* INCREMENTAL PARSER */
+
+/**
+ * @brief initializes an incremental JSON parser.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_json_parser_init(NsonJsonParser *parser);
+
+/**
+ * @brief parses the next @p len bytes of a JSON document.
+ *
+ * @p chunk may be split at any byte and is not referenced after this
+ * function returns. Once an error occurred, all further calls fail.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_json_parser_feed(
+		NsonJsonParser *parser, const char *chunk, size_t len);
+
+/**
+ * @brief completes the document and moves it into @p nson.
+ *
+ * The resources of @p parser are released in any case.
+ *
+ * @return 0 on success, < 0 if the document is incomplete or invalid
+ */
+int nson_json_parser_finish(NsonJsonParser *parser, Nson *nson);
+
+/**
+ * @brief releases the resources of a parser without finishing it.
+ */
+void nson_json_parser_clean(NsonJsonParser *parser);
+
+/**
+ * @brief parses a JSON document on multiple threads.
+ *
+ * Documents whose root is an array are split between its elements and the
+ * parts are parsed concurrently. Other documents are parsed like
+ * nson_parse_json(). One thread per processor is used.
+ *
+ * @return the number of bytes read on success, capped at INT_MAX for
+ * larger documents, < 0 on error
+ */
+int nson_parse_json_thread(Nson *nson, const char *doc, size_t len);
+
+/**
+ * @brief
+ * @return
+ */
+int nson_load_json_thread(Nson *nson, const char *file);
+
+/* NDJSON */
+
+/**
+ * @brief parses newline delimited JSON into an array holding one element
+ * per non-blank line.
+ *
+ * @return 0 on success, < 0 if any line is invalid
+ */
+int nson_parse_ndjson(Nson *nson, const char *doc, size_t len);
+
+/**
+ * @brief
+ * @return
+ */
+int nson_load_ndjson(Nson *nson, const char *file);
+
 /* MAP */
 
 /**
@@ -358,6 +751,36 @@ int nson_map_thread_ext(
 		NsonThreadMapSettings *settings, Nson *nson, NsonMapper mapper,
 		void *user_data);
 
+/**
+ * @brief parses a JSON document on @p settings->threads threads.
+ *
+ * @p settings->chunk_size is the minimal size of a part in bytes. If it
+ * is 0, the document is split into four parts per thread.
+ *
+ * @return the number of bytes read on success, capped at INT_MAX for
+ * larger documents, < 0 on error
+ */
+int nson_parse_json_thread_ext(
+		const NsonThreadMapSettings *settings, Nson *nson, const char *doc,
+		size_t len);
+
+/**
+ * @brief parses newline delimited JSON on a pool of threads.
+ *
+ * The lines are parsed on @p settings->threads threads that reserve
+ * @p settings->chunk_size lines at a time. If @p settings is NULL, one
+ * thread per processor is used.
+ *
+ * If @p errors is not NULL, lines that fail to parse are left out of
+ * @p nson and their 1-based line numbers are collected in @p errors.
+ * Otherwise a single invalid line fails the whole document.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_parse_ndjson_ext(
+		const NsonThreadMapSettings *settings, Nson *nson, Nson *errors,
+		const char *doc, size_t len);
+
 /**
  * @brief
  * @return
@@ -392,6 +815,114 @@ int nson_load_json(Nson *nson, const char *file);
  */
 int nson_parse_json(Nson *nson, const char *doc, size_t len);
 
+/**
+ * @brief parses only the values of @p doc that are named by the JSON
+ * Pointers (RFC 6901) in @p pointers.
+ *
+ * @p nson becomes an array of @p n elements holding the selected values in
+ * the order of @p pointers. Values that do not exist are NSON_NIL, like
+ * null. If @p found is not NULL, it receives @p n flags that tell whether
+ * the value of the respective pointer exists. All pointers are resolved
+ * in a single pass over @p doc. Parts of @p doc that are not on the path
+ * of a pointer are skipped without being validated. If an object on the
+ * path has duplicate keys, the last member is selected, which is the value
+ * nson_obj_get() returns after a full parse.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int nson_parse_json_select(
+		Nson *nson, const char *doc, size_t len, const char **pointers,
+		size_t n, bool *found);
+
+/**
+ * @brief checks that @p doc is a single well-formed JSON value in valid
+ * UTF-8 without building a tree or allocating memory.
+ *
+ * If @p err is not NULL, it is set to the first error found. Containers
+ * may be nested at most 1024 levels deep, so unlike nson_parse_json()
+ * the validator rejects documents that nest deeper.
+ *
+ * @return 0 if @p doc is valid, < 0 otherwise
+ */
+int nson_json_validate(const char *doc, size_t len, NsonError *err);
+
+/**
+ * @brief reports the tokens of the JSON document @p doc to @p events
+ * without building a tree.
+ *
+ * @return the number of bytes read on success, < 0 on error
+ */
+int nson_parse_json_events(
+		const char *doc, size_t len, const NsonJsonEvents *events,
+		void *user_data);
+
+/**
+ * @brief decodes the escape sequences of the JSON string @p src into
+ * @p dest, which must hold at least @p len bytes. @p dest may be @p src.
+ *
+ * @return the length of the decoded string
+ */
+size_t nson_json_unescape(char *dest, const char *src, size_t len);
+
+/* EMITTER */
+
+/**
+ * @brief initializes @p emitter to collect its output in memory. The
+ * output is returned by nson_emit_finish().
+ * @return 0 on success, < 0 on error
+ */
+int nson_emit_init(NsonEmitter *emitter, enum NsonOptions options);
+
+/**
+ * @brief initializes @p emitter to write its output to @p file.
+ * @return 0 on success, < 0 on error
+ */
+int nson_emit_init_file(
+		NsonEmitter *emitter, FILE *file, enum NsonOptions options);
+
+/**
+ * @brief initializes @p emitter to write its output to @p fd.
+ * @return 0 on success, < 0 on error
+ */
+int nson_emit_init_fd(NsonEmitter *emitter, int fd, enum NsonOptions options);
+
+int nson_emit_begin_array(NsonEmitter *emitter);
+int nson_emit_end_array(NsonEmitter *emitter);
+int nson_emit_begin_object(NsonEmitter *emitter);
+int nson_emit_end_object(NsonEmitter *emitter);
+
+/**
+ * @brief writes the key of the next object member. Every key must be
+ * followed by a value.
+ * @return 0 on success, < 0 on error
+ */
+int nson_emit_key(NsonEmitter *emitter, const char *key, size_t len);
+int nson_emit_string(NsonEmitter *emitter, const char *str, size_t len);
+int nson_emit_int(NsonEmitter *emitter, int64_t value);
+int nson_emit_real(NsonEmitter *emitter, double value);
+int nson_emit_bool(NsonEmitter *emitter, bool value);
+int nson_emit_null(NsonEmitter *emitter);
+
+/**
+ * @brief serializes the tree @p value as the next value.
+ * @return 0 on success, < 0 on error
+ */
+int nson_emit_value(NsonEmitter *emitter, const Nson *value);
+
+/**
+ * @brief completes the output of @p emitter and releases its resources.
+ *
+ * For emitters created with nson_emit_init(), @p str and @p size receive
+ * the NUL terminated output, which must be freed by the caller. Both are
+ * ignored for other emitters.
+ *
+ * Calls that would produce invalid JSON fail with errno EINVAL. After
+ * an error, all further calls fail.
+ *
+ * @return 0 if exactly one complete value was written, < 0 otherwise
+ */
+int nson_emit_finish(NsonEmitter *emitter, char **str, size_t *size);
+
 /* INI */
 
 /**
@@ -424,6 +955,7 @@ int nson_init_arr(Nson *array);
 size_t nson_arr_len(const Nson *array);
 Nson *nson_arr_get(const Nson *array, off_t index);
 int nson_arr_push(Nson *array, Nson *value);
+int nson_arr_reserve(Nson *array, size_t capacity);
 int nson_arr_pop(Nson *last, Nson *array);
 int nson_arr_concat(Nson *array_1, Nson *array_2);
 Nson *nson_arr_last(Nson *array);
@@ -432,6 +964,7 @@ int nson_arr_push_int(Nson *array, int value);
 Nson *nson_obj_get(Nson *object, const char *key);
 int nson_obj_put(Nson *object, const char *key, Nson *value);
 size_t nson_obj_size(const Nson *object);
+int nson_obj_reserve(Nson *object, size_t capacity);
 const char *nson_obj_get_key(Nson *object, int index);
 int nson_obj_from_arr(Nson *object);
 
@@ -439,9 +972,22 @@ int nson_json_serialize(
 		char **str, size_t *size, Nson *nson, enum NsonOptions options);
 int nson_json_write(FILE *out, const Nson *nson, enum NsonOptions options);
 
+/**
+ * @brief serializes @p nson to @p fd through a fixed size buffer. Large
+ * strings are written from their storage without being copied.
+ * @return 0 on success, < 0 on error
+ */
+int nson_json_write_fd(int fd, const Nson *nson, enum NsonOptions options);
+
 int nson_plist_serialize(
 		char **str, size_t *size, Nson *nson, enum NsonOptions options);
 int nson_plist_write(FILE *out, const Nson *nson, enum NsonOptions options);
+
+/**
+ * @brief serializes @p nson to @p fd through a fixed size buffer.
+ * @return 0 on success, < 0 on error
+ */
+int nson_plist_write_fd(int fd, const Nson *nson, enum NsonOptions options);
 int nson_ptr_wrap(Nson *nson, void *ptr, void (*dtor)(void *));
 void *nson_ptr(const Nson *nson);
 
@@ -0,0 +1,313 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <errno.h>
+#include <float.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pow5.h"
+
+/*
+ * Numbers are parsed into a decimal mantissa of up to 19 significant
+ * digits and a decimal exponent. Integers that fit into an int64_t are
+ * returned as NSON_INT. Everything else is converted to a double: small
+ * values are calculated exactly with a single floating point operation,
+ * the rest with the Eisel-Lemire algorithm. Mantissas with more than 19
+ * significant digits fall back to strtod().
+ */
+
+#define MAX_DIGITS 19
+#define MAX_EXPONENT 100000
+
+static const double exact_pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool
+is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static bool
+is_eight_digits(uint64_t val) {
+	return ((val & 0xF0F0F0F0F0F0F0F0) |
+			(((val + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+			0x3333333333333333;
+}
+
+static uint32_t
+parse_eight_digits(uint64_t val) {
+	const uint64_t mask = 0x000000FF000000FF;
+	const uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+	const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+
+	val -= 0x3030303030303030;
+	val = (val * 10) + (val >> 8);
+	val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+	return val;
+}
+#endif
+
+/*
+ * Appends the digits at the start of src to mantissa. The mantissa
+ * silently overflows; callers only trust it up to MAX_DIGITS digits.
+ */
+static size_t
+parse_digits(uint64_t *mantissa, const char *src, size_t len) {
+	size_t i = 0;
+	uint64_t m = *mantissa;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t val;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&val, &src[i], sizeof(val));
+		if (!is_eight_digits(val)) {
+			break;
+		}
+		m = m * 100000000 + parse_eight_digits(val);
+	}
+#endif
+	for (; i < len && is_digit(src[i]); i++) {
+		m = m * 10 + (src[i] - '0');
+	}
+
+	*mantissa = m;
+	return i;
+}
+
+static void
+mul128(uint64_t *hi, uint64_t *lo, uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128)a * b;
+
+	*hi = r >> 64;
+	*lo = r;
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi;
+	uint64_t p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+	uint64_t mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+
+	*lo = (mid << 32) | (uint32_t)p0;
+	*hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+static double
+to_double(bool negative, uint64_t mantissa, int64_t exponent) {
+	double d;
+	uint64_t bits = mantissa | (uint64_t)exponent << 52 |
+			(uint64_t)negative << 63;
+
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+/*
+ * Converts mantissa * 10^exp10 to the nearest double. mantissa must
+ * not be 0. See Daniel Lemire, "Number Parsing at a Gigabyte per Second".
+ */
+static double
+eisel_lemire(bool negative, uint64_t mantissa, int64_t exp10) {
+	int lz;
+	uint64_t hi, lo, hi2, lo2, upperbit;
+	int64_t exponent;
+	const uint64_t *pow5;
+
+	if (exp10 < NSON_POW5_MIN) {
+		return negative ? -0.0 : 0.0;
+	} else if (exp10 > NSON_POW5_MAX) {
+		return to_double(negative, 0, 0x7FF);
+	}
+	pow5 = nson_pow5[exp10 - NSON_POW5_MIN];
+
+	lz = __builtin_clzll(mantissa);
+	mantissa <<= lz;
+	mul128(&hi, &lo, mantissa, pow5[0]);
+	if ((hi & 0x1FF) == 0x1FF) {
+		// The product is close to a rounding boundary, refine it with the
+		// lower half of the power of five.
+		mul128(&hi2, &lo2, mantissa, pow5[1]);
+		lo += hi2;
+		if (hi2 > lo) {
+			hi++;
+		}
+	}
+
+	upperbit = hi >> 63;
+	mantissa = hi >> (upperbit + 9);
+	lz += 1 ^ upperbit;
+	// floor(log2(10^exp10)) + bias + 64 - lz
+	exponent = (((152170 + 65536) * exp10) >> 16) + 1024 + 63 - lz;
+
+	if (exponent <= 0) {
+		// subnormal
+		if (-exponent + 1 >= 64) {
+			return negative ? -0.0 : 0.0;
+		}
+		mantissa >>= -exponent + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		exponent = mantissa < (UINT64_C(1) << 52) ? 0 : 1;
+		return to_double(negative, mantissa & ~(UINT64_C(1) << 52), exponent);
+	}
+
+	// Values exactly in the middle of two doubles round to even
+	if (lo <= 1 && exp10 >= -4 && exp10 <= 23 && (mantissa & 3) == 1 &&
+		(mantissa << (upperbit + 9)) == hi) {
+		mantissa &= ~UINT64_C(1);
+	}
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= (UINT64_C(2) << 52)) {
+		mantissa = UINT64_C(1) << 52;
+		exponent++;
+	}
+	if (exponent >= 0x7FF) {
+		return to_double(negative, 0, 0x7FF);
+	}
+	return to_double(negative, mantissa & ~(UINT64_C(1) << 52), exponent);
+}
+
+static int
+parse_slow(double *dest, const char *src, size_t len) {
+	char stack_buf[64];
+	char *buf = stack_buf;
+
+	if (len >= sizeof(stack_buf)) {
+		buf = malloc(len + 1);
+		if (buf == NULL) {
+			return -1;
+		}
+	}
+	memcpy(buf, src, len);
+	buf[len] = '\0';
+	*dest = strtod(buf, NULL);
+
+	if (buf != stack_buf) {
+		free(buf);
+	}
+	return 0;
+}
+
+off_t
+__nson_parse_number(Nson *nson, const char *src, size_t len) {
+	size_t i = 0, n, digits;
+	bool negative = false, is_real = false, exp_negative = false;
+	uint64_t mantissa = 0;
+	int64_t exp10 = 0, exp_val = 0;
+	double r_val;
+
+	if (i < len && (src[i] == '-' || src[i] == '+')) {
+		negative = src[i] == '-';
+		i++;
+	}
+	if (i >= len || !is_digit(src[i])) {
+		return -1;
+	}
+
+	// Leading zeros do not count towards the significant digits
+	for (; i < len && src[i] == '0'; i++)
+		;
+	n = parse_digits(&mantissa, &src[i], len - i);
+	digits = n;
+	i += n;
+
+	if (i < len && src[i] == '.') {
+		is_real = true;
+		i++;
+		if (i >= len || !is_digit(src[i])) {
+			return -1;
+		}
+		if (mantissa == 0) {
+			for (n = i; i < len && src[i] == '0'; i++)
+				;
+			exp10 -= i - n;
+		}
+		n = parse_digits(&mantissa, &src[i], len - i);
+		digits += n;
+		exp10 -= n;
+		i += n;
+	}
+
+	if (i < len && (src[i] == 'e' || src[i] == 'E')) {
+		is_real = true;
+		i++;
+		if (i < len && (src[i] == '-' || src[i] == '+')) {
+			exp_negative = src[i] == '-';
+			i++;
+		}
+		if (i >= len || !is_digit(src[i])) {
+			return -1;
+		}
+		for (; i < len && is_digit(src[i]); i++) {
+			if (exp_val < MAX_EXPONENT) {
+				exp_val = exp_val * 10 + (src[i] - '0');
+			}
+		}
+		exp10 += exp_negative ? -exp_val : exp_val;
+	}
+
+	if (digits > MAX_DIGITS) {
+		if (parse_slow(&r_val, src, i) < 0) {
+			return -1;
+		}
+	} else if (!is_real && mantissa <= (uint64_t)INT64_MAX) {
+		nson_int_wrap(nson, negative ? -(int64_t)mantissa : (int64_t)mantissa);
+		return i;
+	} else if (!is_real && negative && mantissa == (uint64_t)INT64_MAX + 1) {
+		nson_int_wrap(nson, INT64_MIN);
+		return i;
+	} else if (mantissa == 0) {
+		r_val = negative ? -0.0 : 0.0;
+	} else if (mantissa <= (UINT64_C(1) << 53) && exp10 >= -22 &&
+			   exp10 <= 22) {
+		// Both operands are exact, so a single operation rounds correctly
+		r_val = mantissa;
+		if (exp10 < 0) {
+			r_val /= exact_pow10[-exp10];
+		} else {
+			r_val *= exact_pow10[exp10];
+		}
+		r_val = negative ? -r_val : r_val;
+	} else {
+		r_val = eisel_lemire(negative, mantissa, exp10);
+	}
+
+	nson_real_wrap(nson, r_val);
+	return i;
+}
@@ -4,73 +4,264 @@
 #include <errno.h>
 #include <string.h>
 
-static int
-cmp_stable(const void *a, const void *b) {
-	const NsonObjectEntry *na = a, *nb = b;
-	int rv = nson_cmp(&na->key, &nb->key);
-	return rv ? rv : (na - nb);
+/*
+ * Objects keep their entries in insertion order. Lookups in objects of
+ * less than OBJ_SORTED_MIN entries scan the entries. Larger objects get an
+ * index on their first lookup: a permutation of the entries sorted by key
+ * for binary search, or an open addressing hash table from OBJ_HASH_MIN
+ * entries on. Slots of the hash table hold the position of an entry plus
+ * one, 0 marks an empty slot.
+ *
+ * If a key appears more than once, lookups return the last entry.
+ */
+#define OBJ_SORTED_MIN 8
+#define OBJ_HASH_MIN 64
+
+struct NsonObjectIndex {
+	/* 0 for a sorted permutation */
+	size_t mask;
+	uint32_t slots[];
+};
+
+static size_t
+obj_cap(const Nson *nson) {
+	return nson->o.arr ? NSON_MEM(nson->o.arr)->cap : 0;
+}
+
+static struct NsonObjectIndex *
+obj_index(const Nson *nson) {
+	return nson->o.arr ? NSON_MEM(nson->o.arr)->index : NULL;
 }
 
 static int
-mem_capacity(Nson *nson, const size_t size) {
+mem_capacity(Nson *nson, const size_t cap) {
 	NsonObjectEntry *arr;
-	const size_t old = nson_obj_size(nson);
 
-	if (size == old) {
-		return size;
-	}
-
-	arr = nson->o.arr;
-	nson->o.len = size;
-
-	if (size && size > SIZE_MAX / sizeof(*arr)) {
-		errno = ENOMEM;
+	NSON_LAZY_LOAD(nson);
+	if (nson->c.flags & NSON_FLAG_ARENA) {
+		// arena storage can not be reallocated
+		errno = EPERM;
 		return -1;
 	}
-	arr = reallocarray(arr, size, sizeof(*arr));
+	if (cap <= obj_cap(nson)) {
+		return 0;
+	}
+	// the index moves together with the entries
+	arr = __nson_mem_resize(nson->o.arr, cap, sizeof(*arr));
 	if (!arr) {
-		nson->o.len = old;
 		return -1;
 	}
-	if (size > old)
-		memset(&arr[old], 0, sizeof(*arr) * (size - old));
 
 	nson->o.arr = arr;
-	return size;
+	return 0;
 }
 
 static int
-obj_sort(Nson *object) {
-	qsort(object->o.arr, object->o.len, sizeof *object->o.arr, cmp_stable);
-	object->c.type = NSON_OBJ;
+mem_grow(Nson *nson, const size_t size) {
+	size_t cap = obj_cap(nson);
 
-	return 0;
+	// arena containers are rejected by mem_capacity()
+	if (size <= cap && !(nson->c.flags & NSON_FLAG_ARENA)) {
+		return 0;
+	}
+	for (cap = cap < 4 ? 4 : cap; cap < size;) {
+		cap = cap > UINT32_MAX / 2 ? size : cap * 2;
+	}
+	return mem_capacity(nson, cap);
 }
 
 static int
-search_key(const void *key, const void *elem) {
-	return strcmp(key, nson_str(elem));
+key_cmp(const NsonObjectEntry *entry, const char *key, size_t len) {
+	int rv;
+	const size_t entry_len = nson_data_len(&entry->key);
+
+	rv = memcmp(nson_data(&entry->key), key, MIN(entry_len, len));
+	return rv ? rv : SCAL_CMP(entry_len, len);
+}
+
+static bool
+key_equals(const NsonObjectEntry *entry, const char *key, size_t len) {
+	const char *data;
+
+	if (nson_data_len(&entry->key) != len) {
+		return false;
+	}
+	// interned keys share their buffer
+	data = nson_data(&entry->key);
+	return data == key || memcmp(data, key, len) == 0;
+}
+
+static void
+index_drop(Nson *object) {
+	// arena objects are read only, their index is never dropped
+	if (!(object->c.flags & NSON_FLAG_ARENA)) {
+		free(obj_index(object));
+	}
+	NSON_MEM(object->o.arr)->index = NULL;
+}
+
+static struct NsonObjectIndex *
+index_alloc(size_t slots, NsonArena *arena) {
+	struct NsonObjectIndex *index;
+	const size_t size = sizeof(*index) + slots * sizeof(*index->slots);
+
+	if (arena == NULL) {
+		return calloc(1, size);
+	} else if ((index = __nson_arena_alloc(arena, size))) {
+		memset(index, 0, size);
+	}
+	return index;
+}
+
+/*
+ * Adds the entry at @p pos to a hash index. Later entries with the same
+ * key replace earlier ones.
+ */
+static void
+index_insert(struct NsonObjectIndex *index, NsonObjectEntry *arr, size_t pos) {
+	size_t slot;
+	const char *key = nson_data(&arr[pos].key);
+	const size_t len = nson_data_len(&arr[pos].key);
+
+	slot = __nson_hash(key, len) & index->mask;
+	for (; index->slots[slot]; slot = (slot + 1) & index->mask) {
+		if (key_equals(&arr[index->slots[slot] - 1], key, len)) {
+			break;
+		}
+	}
+	index->slots[slot] = pos + 1;
+}
+
+static struct NsonObjectIndex *
+index_hash(NsonObjectEntry *arr, size_t len, NsonArena *arena) {
+	size_t i, cap;
+	struct NsonObjectIndex *index;
+
+	// keep the load factor at or below 1/2
+	for (cap = OBJ_HASH_MIN * 2; cap < len * 2; cap *= 2)
+		;
+	index = index_alloc(cap, arena);
+	if (index == NULL) {
+		return NULL;
+	}
+	index->mask = cap - 1;
+	for (i = 0; i < len; i++) {
+		index_insert(index, arr, i);
+	}
+	return index;
+}
+
+static struct NsonObjectIndex *
+index_sorted(NsonObjectEntry *arr, size_t len) {
+	size_t i, j;
+	uint32_t pos;
+	struct NsonObjectIndex *index = index_alloc(len, NULL);
+
+	if (index == NULL) {
+		return NULL;
+	}
+	// sorted indexes are small, an insertion sort keeps them stable
+	for (i = 0; i < len; i++) {
+		pos = i;
+		for (j = i; j > 0 && nson_cmp(&arr[index->slots[j - 1]].key,
+									  &arr[pos].key) > 0;
+			 j--) {
+			index->slots[j] = index->slots[j - 1];
+		}
+		index->slots[j] = pos;
+	}
+	return index;
+}
+
+static void
+index_build(Nson *object) {
+	const size_t len = object->o.len;
+
+	index_drop(object);
+	// without an index the object is still searchable
+	if (len >= UINT32_MAX || object->c.flags & NSON_FLAG_ARENA) {
+		return;
+	} else if (len >= OBJ_HASH_MIN) {
+		NSON_MEM(object->o.arr)->index = index_hash(object->o.arr, len, NULL);
+	} else if (len >= OBJ_SORTED_MIN) {
+		NSON_MEM(object->o.arr)->index = index_sorted(object->o.arr, len);
+	}
 }
 
 static NsonObjectEntry *
-obj_search(Nson *object, const char *key) {
-	if (object->o.messy) {
-		obj_sort(object);
+search_hash(const Nson *object, const char *key, size_t len) {
+	size_t slot, pos;
+	const struct NsonObjectIndex *index = obj_index(object);
+
+	slot = __nson_hash(key, len) & index->mask;
+	for (; (pos = index->slots[slot]); slot = (slot + 1) & index->mask) {
+		if (key_equals(&object->o.arr[pos - 1], key, len)) {
+			return &object->o.arr[pos - 1];
+		}
 	}
+	return NULL;
+}
 
-	return bsearch(
-			key, object->o.arr, object->o.len, sizeof *object->o.arr,
-			search_key);
+static NsonObjectEntry *
+search_sorted(const Nson *object, const char *key, size_t len) {
+	size_t low = 0, high = object->o.len, mid;
+	const uint32_t *slots = obj_index(object)->slots;
+
+	// find the first entry after all entries <= key
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (key_cmp(&object->o.arr[slots[mid]], key, len) <= 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low > 0 && key_equals(&object->o.arr[slots[low - 1]], key, len)) {
+		return &object->o.arr[slots[low - 1]];
+	}
+	return NULL;
 }
 
 static NsonObjectEntry *
-obj_last(Nson *object) {
-	size_t len = nson_obj_size(object);
-	if (len == 0) {
-		return NULL;
+search_linear(const Nson *object, const char *key, size_t len) {
+	size_t i;
+
+	for (i = object->o.len; i > 0; i--) {
+		if (key_equals(&object->o.arr[i - 1], key, len)) {
+			return &object->o.arr[i - 1];
+		}
+	}
+	return NULL;
+}
+
+static NsonObjectEntry *
+obj_search(Nson *object, const char *key) {
+	const size_t len = strlen(key);
+	struct NsonObjectIndex *index;
+
+	NSON_LAZY_LOAD(object);
+	if (obj_index(object) == NULL && object->o.len >= OBJ_SORTED_MIN) {
+		index_build(object);
+	}
+
+	index = obj_index(object);
+	if (index == NULL) {
+		return search_linear(object, key, len);
+	} else if (index->mask) {
+		return search_hash(object, key, len);
 	} else {
-		return &object->o.arr[len - 1];
+		return search_sorted(object, key, len);
+	}
+}
+
+int
+__nson_obj_index_arena(Nson *object, NsonArena *arena) {
+	if (object->o.len < OBJ_HASH_MIN || object->o.len >= UINT32_MAX) {
+		return 0;
 	}
+	NSON_MEM(object->o.arr)->index =
+			index_hash(object->o.arr, object->o.len, arena);
+	return obj_index(object) ? 0 : -1;
 }
 
 NsonObjectEntry *
@@ -85,16 +276,18 @@ __nson_obj_get_entry(const Nson *object, int index) {
 int
 __nson_obj_clone(Nson *object) {
 	int rv = 0;
+	size_t len = nson_obj_size(object);
 	NsonObjectEntry *arr = object->o.arr;
-	size_t len = nson_arr_len(object);
 
 	object->o.arr = NULL;
 	object->o.len = 0;
+	object->c.flags &= ~NSON_FLAG_ARENA;
 
 	rv = mem_capacity(object, len);
 	if (rv < 0 || object->o.arr == NULL)
 		return rv;
 	memcpy(object->o.arr, arr, len * sizeof(*arr));
+	object->o.len = len;
 
 	return rv;
 }
@@ -125,30 +318,69 @@ int
 nson_obj_put(Nson *object, const char *key, Nson *value) {
 	assert(nson_type(object) == NSON_OBJ);
 	NsonObjectEntry *new_elem;
+	struct NsonObjectIndex *index;
 	Nson obj_key = {0};
 
 	nson_init_str(&obj_key, key);
 
-	if (object->o.messy && nson_obj_size(object) > 0 &&
-		nson_cmp(&obj_last(object)->key, &obj_key) > 0) {
-		object->o.messy = 1;
-	}
-
 	size_t old_len = nson_obj_size(object);
-	mem_capacity(object, old_len + 1);
+	if (mem_grow(object, old_len + 1) < 0) {
+		nson_clean(&obj_key);
+		return -1;
+	}
 
 	new_elem = &object->o.arr[old_len];
 	nson_move(&new_elem->key, &obj_key);
 	nson_move(&new_elem->value, value);
-
+	object->o.len = old_len + 1;
+
+	index = obj_index(object);
+	if (index == NULL) {
+		return 0;
+	} else if (index->mask == 0) {
+		// the sorted index is rebuilt on the next lookup
+		index_drop(object);
+	} else if (object->o.len * 2 > index->mask + 1) {
+		index_build(object);
+	} else {
+		index_insert(index, object->o.arr, old_len);
+	}
 	return 0;
 }
 
+int
+nson_obj_reserve(Nson *object, size_t capacity) {
+	assert(nson_type(object) == NSON_OBJ);
+
+	return mem_capacity(object, capacity);
+}
+
 size_t
 nson_obj_size(const Nson *object) {
+	NSON_LAZY_LOAD(object);
 	return object->o.len;
 }
 
+int
+__nson_obj_shrink(Nson *object) {
+	NsonObjectEntry *arr;
+	size_t len = nson_obj_size(object);
+
+	if (len == obj_cap(object) || object->c.flags & NSON_FLAG_ARENA) {
+		return 0;
+	} else if (len == 0) {
+		free(obj_index(object));
+		__nson_mem_free(object->o.arr);
+		arr = NULL;
+	} else if ((arr = __nson_mem_resize(object->o.arr, len, sizeof(*arr))) ==
+			   NULL) {
+		return -1;
+	}
+
+	object->o.arr = arr;
+	return 0;
+}
+
 int
 __nson_obj_clean(Nson *object) {
 	assert(nson_type(object) == NSON_OBJ);
@@ -161,7 +393,8 @@ __nson_obj_clean(Nson *object) {
 		rv |= nson_clean(&entry->key);
 		rv |= nson_clean(&entry->value);
 	}
-	free(object->o.arr);
+	free(obj_index(object));
+	__nson_mem_free(object->o.arr);
 
 	return rv;
 }
@@ -178,9 +411,13 @@ nson_obj_from_arr(Nson *array) {
 	nson_init(&obj, NSON_OBJ);
 
 	obj.c.type = NSON_OBJ;
-	obj.o.messy = true;
+	obj.c.flags = array->c.flags;
 	obj.o.arr = (NsonObjectEntry *)array->a.arr;
 	obj.o.len = array->a.len / 2;
+	if (obj.o.arr) {
+		// the capacity was counted in values
+		NSON_MEM(obj.o.arr)->cap /= 2;
+	}
 
 	nson_move(array, &obj);
 	return 0;
@@ -192,14 +429,16 @@ nson_obj_to_arr(Nson *object) {
 
 	object->c.type = NSON_OBJ;
 	object->o.len = object->a.len / 2;
-	object->o.messy = true;
+	if (object->o.arr) {
+		NSON_MEM(object->o.arr)->cap /= 2;
+	}
 
 	return 0;
 }
 
 int
 __nson_obj_serialize(
-		FILE *out, const Nson *object, const NsonSerializerInfo *info,
+		NsonWriter *out, const Nson *object, const NsonSerializerInfo *info,
 		enum NsonOptions options) {
 	int i;
 	size_t size = nson_obj_size(object);
@@ -207,14 +446,20 @@ __nson_obj_serialize(
 
 	for (i = 0; i < size; i++) {
 		entry = __nson_obj_get_entry(object, i);
-		info->serializer(
-				out, &entry->key, options | NSON_IS_KEY | NSON_SKIP_HEADER);
-		fputs(info->key_value_seperator, out);
-		info->serializer(out, &entry->value, options | NSON_SKIP_HEADER);
+		if (info->serializer(
+					out, &entry->key,
+					options | NSON_IS_KEY | NSON_SKIP_HEADER) < 0) {
+			return -1;
+		}
+		__nson_writer_puts(out, info->key_value_seperator);
+		if (info->serializer(
+					out, &entry->value, options | NSON_SKIP_HEADER) < 0) {
+			return -1;
+		}
 		if (i + 1 != size) {
-			fputs(info->seperator, out);
+			__nson_writer_puts(out, info->seperator);
 		}
 	}
 
-	return 0;
+	return out->error ? -1 : 0;
 }
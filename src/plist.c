@@ -32,7 +32,6 @@
 
 #include <assert.h>
 #include <ctype.h>
-#include <inttypes.h>
 #include <string.h>
 
 #define SKIP_SPACES \
@@ -41,22 +40,23 @@
 			; \
 	} while (0)
 
-static int
-parse_string(NsonBuf **dest_buf, const char *src, const size_t len) {
+/*
+ * Decodes the entities of @p src into @p dest. The decoded string is never
+ * longer than its source, so @p dest may be the same as @p src.
+ */
+static size_t
+plist_unescape(char *dest, const char *src, const size_t len) {
 	const char *chunk_start, *chunk_end;
 	size_t chunk_len;
-	char *dest;
+	char *dest_start = dest;
 	int64_t val;
 
-	(*dest_buf) = __nson_buf_new(len);
-	dest = __nson_buf(*dest_buf);
-
 	for (chunk_start = src;
 		 (chunk_end = memchr(chunk_start, '&', len - (chunk_start - src)));
 		 dest++) {
 		chunk_len = chunk_end - chunk_start;
 
-		memcpy(dest, chunk_start, chunk_len);
+		memmove(dest, chunk_start, chunk_len);
 		dest += chunk_len;
 		chunk_start = chunk_end + 1;
 
@@ -65,7 +65,8 @@ parse_string(NsonBuf **dest_buf, const char *src, const size_t len) {
 			chunk_start += __nson_parse_dev(
 					&val, chunk_start, len - (chunk_start - src));
 			if (chunk_start[0] == ';') {
-				chunk_start += __nson_to_utf8(dest, val, 3);
+				chunk_start++;
+				dest += __nson_to_utf8(dest, val, 4) - 1;
 			} else {
 				*dest = '&';
 			}
@@ -83,11 +84,48 @@ parse_string(NsonBuf **dest_buf, const char *src, const size_t len) {
 		}
 	}
 	chunk_len = src + len - chunk_start;
-	memcpy(dest, chunk_start, chunk_len);
+	memmove(dest, chunk_start, chunk_len);
 	dest += chunk_len;
-	__nson_buf_shrink(*dest_buf, dest - __nson_buf(*dest_buf));
 
-	return dest - __nson_buf(*dest_buf);
+	return dest - dest_start;
+}
+
+static int
+parse_string(Nson *nson, const char *src, const size_t len) {
+	size_t str_len;
+	char *str;
+	NsonBuf *buf;
+
+	if (len <= NSON_INLINE_SIZE) {
+		str = __nson_init_inline(nson, NULL, len, NSON_STR);
+		str_len = plist_unescape(str, src, len);
+		__nson_inline_set_len(nson, str_len);
+		return str_len;
+	}
+
+	buf = __nson_buf_new(len);
+	if (buf == NULL) {
+		return -1;
+	}
+	str_len = plist_unescape(__nson_buf(buf), src, len);
+	__nson_buf_shrink(buf, str_len);
+	__nson_init_buf(nson, buf, NSON_STR);
+	__nson_buf_release(buf);
+
+	return str_len;
+}
+
+static int
+parse_string_insitu(Nson *nson, char *src, const size_t len) {
+	size_t str_len = plist_unescape(src, src, len);
+
+	// Overwrites the '<' of the closing tag or a part of the entities
+	src[str_len] = '\0';
+	if (str_len > UINT32_MAX) {
+		// too long to be referenced, see __nson_init_ref()
+		return nson_init_data(nson, src, str_len, NSON_STR);
+	}
+	return __nson_init_ref(nson, src, str_len, NSON_STR);
 }
 
 int
@@ -142,17 +180,38 @@ measure_string_len(const char *str, const char *end_tag, size_t len) {
 	return p - str - 2;
 }
 
-int
-nson_parse_plist(Nson *nson, const char *doc, size_t len) {
+static int
+parse_blob_arena(Nson *nson, NsonBuf *buf, NsonArena *arena) {
+	size_t len = __nson_buf_siz(buf);
+	char *data;
+
+	if (len > UINT32_MAX) {
+		// too long to be referenced, keep the buffer instead
+		__nson_init_buf(nson, buf, NSON_BLOB);
+		__nson_buf_release(buf);
+		return 0;
+	}
+	data = __nson_arena_strndup(arena, __nson_buf(buf), len);
+	__nson_buf_release(buf);
+	if (data == NULL) {
+		return -1;
+	}
+	return __nson_init_ref(nson, data, len, NSON_BLOB);
+}
+
+static int
+plist_parse(
+		Nson *nson, const char *doc, size_t len, char *insitu,
+		NsonArena *arena) {
 	int rv = 0;
 	off_t i = 0;
 	int64_t i_val;
 	off_t str_len;
 	static const char *string_tag = "string";
+	char *str;
 	NsonBuf *buf;
-	Nson old_top;
-	Nson *stack_top;
-	Nson stack = {{{0}}}, tmp = {{{0}}};
+	NsonBuilder builder = {.arena = arena};
+	Nson tmp = {{{0}}};
 
 	rv = skip_tag("<?xml", &doc[i], len - i);
 	if (rv <= 0) {
@@ -175,10 +234,6 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 	i += rv;
 
 	memset(nson, 0, sizeof(*nson));
-	nson_init(&tmp, NSON_ARR);
-	nson_init(&stack, NSON_ARR);
-	nson_arr_push(&stack, &tmp);
-	stack_top = nson_arr_get(&stack, 0);
 
 	do {
 		SKIP_SPACES;
@@ -191,16 +246,16 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 			if ((rv = skip_tag("array", &doc[i], len - i)) <= 0) {
 				break;
 			}
-			nson_init(&tmp, NSON_ARR);
-			nson_arr_push(&stack, &tmp);
-			stack_top = nson_arr_last(&stack);
+			if (__nson_builder_open(&builder, NSON_ARR) < 0) {
+				goto err;
+			}
 			i += rv;
 			break;
 		case 'd':
 			if ((rv = skip_tag("dict", &doc[i], len - i)) > 0) {
-				nson_init(&tmp, NSON_ARR);
-				nson_arr_push(&stack, &tmp);
-				stack_top = nson_arr_last(&stack);
+				if (__nson_builder_open(&builder, NSON_OBJ) < 0) {
+					goto err;
+				}
 				i += rv;
 			} else if ((rv = skip_tag("data", &doc[i], len - i)) > 0) {
 				i += rv;
@@ -213,9 +268,15 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 				if (rv < 0) {
 					goto err;
 				}
-				__nson_init_buf(&tmp, buf, NSON_BLOB);
-				__nson_buf_release(buf);
-				nson_arr_push(stack_top, &tmp);
+				if (arena) {
+					rv = parse_blob_arena(&tmp, buf, arena);
+				} else {
+					rv = __nson_init_buf(&tmp, buf, NSON_BLOB);
+					__nson_buf_release(buf);
+				}
+				if (rv < 0 || __nson_builder_push(&builder, &tmp) < 0) {
+					goto err;
+				}
 				i += str_len + 2;
 				rv = skip_tag("data", &doc[i], len - i);
 				i += rv;
@@ -233,10 +294,17 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 				goto err;
 			}
 			str_len = rv;
-			parse_string(&buf, &doc[i], str_len);
-			__nson_init_buf(&tmp, buf, NSON_STR);
-			__nson_buf_release(buf);
-			nson_arr_push(stack_top, &tmp);
+			if (insitu) {
+				rv = parse_string_insitu(&tmp, &insitu[i], str_len);
+			} else if (arena) {
+				str = __nson_arena_strndup(arena, &doc[i], str_len);
+				rv = str ? parse_string_insitu(&tmp, str, str_len) : -1;
+			} else {
+				rv = parse_string(&tmp, &doc[i], str_len);
+			}
+			if (rv < 0 || __nson_builder_push(&builder, &tmp) < 0) {
+				goto err;
+			}
 			i += str_len + 2;
 			rv = skip_tag(string_tag, &doc[i], len - i);
 			i += rv;
@@ -255,7 +323,9 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 			if (nson_type(&tmp) == NSON_INT) {
 				nson_real_wrap(&tmp, nson_real(&tmp));
 			}
-			nson_arr_push(stack_top, &tmp);
+			if (__nson_builder_push(&builder, &tmp) < 0) {
+				goto err;
+			}
 			if ((rv = skip_tag("</real", &doc[i], len - i)) <= 0) {
 				break;
 			}
@@ -272,7 +342,9 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 			}
 			i += rv;
 			nson_int_wrap(&tmp, i_val);
-			nson_arr_push(stack_top, &tmp);
+			if (__nson_builder_push(&builder, &tmp) < 0) {
+				goto err;
+			}
 			if ((rv = skip_tag("</integer", &doc[i], len - i)) <= 0) {
 				break;
 			}
@@ -283,7 +355,9 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 				break;
 			}
 			nson_bool_wrap(&tmp, 1);
-			nson_arr_push(stack_top, &tmp);
+			if (__nson_builder_push(&builder, &tmp) < 0) {
+				goto err;
+			}
 			i += rv;
 			break;
 		case 'f':
@@ -291,7 +365,9 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 				break;
 			}
 			nson_bool_wrap(&tmp, 0);
-			nson_arr_push(stack_top, &tmp);
+			if (__nson_builder_push(&builder, &tmp) < 0) {
+				goto err;
+			}
 			i += rv;
 			break;
 		case '/':
@@ -304,48 +380,25 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 				if ((rv = skip_tag("array", &doc[i], len - i)) <= 0) {
 					break;
 				}
-				if (nson_type(stack_top) != NSON_ARR) {
-					goto err;
-				}
-				if (nson_arr_len(&stack) == 0) {
-					goto err;
-				}
-				nson_arr_pop(&old_top, &stack);
-				stack_top = nson_arr_last(&stack);
-				if (stack_top == NULL) {
+				if (__nson_builder_close(&builder, NSON_ARR) < 0) {
 					goto err;
 				}
-				nson_arr_push(stack_top, &old_top);
 				i += rv;
 				break;
 			case 'd':
-				// TODO
-				if (nson_obj_from_arr(stack_top) < 0) {
-					goto err;
-				}
 				if ((rv = skip_tag("dict", &doc[i], len - i)) <= 0) {
 					break;
 				}
-				if (nson_type(stack_top) != NSON_OBJ) {
-					goto err;
-				}
-				if (nson_arr_len(&stack) == 0) {
-					goto err;
-				}
-				nson_arr_pop(&old_top, &stack);
-				stack_top = nson_arr_last(&stack);
-				if (stack_top == NULL) {
+				if (__nson_builder_close(&builder, NSON_OBJ) < 0) {
 					goto err;
 				}
-				nson_arr_push(stack_top, &old_top);
 				i += rv;
 				break;
 			}
 		}
-	} while (nson_arr_len(&stack) > 1 && i < len);
-	if (nson_arr_len(&stack) != 1) {
+	} while (builder.depth > 0 && i < len);
+	if (builder.depth != 0) {
 		// Premature EOF
-		rv = -1;
 		goto err;
 	}
 	SKIP_SPACES;
@@ -356,167 +409,204 @@ nson_parse_plist(Nson *nson, const char *doc, size_t len) {
 	}
 	i += rv;
 
-	if (nson_arr_len(stack_top) == 0) {
-		rv = -1;
+	if (__nson_builder_finish(&builder, nson) < 0) {
 		goto err;
 	}
-	nson_move(nson, nson_arr_get(stack_top, 0));
 
 	rv = i;
-
+	__nson_builder_clean(&builder);
+	return rv;
 err:
+	__nson_builder_clean(&builder);
+	return -1;
+}
 
-	nson_clean(&stack);
-	return rv;
+int
+nson_parse_plist(Nson *nson, const char *doc, size_t len) {
+	return plist_parse(nson, doc, len, NULL, NULL);
+}
+
+int
+__nson_parse_plist_insitu(Nson *nson, char *doc, size_t len) {
+	return plist_parse(nson, doc, len, doc, NULL);
+}
+
+int
+__nson_parse_plist_arena(
+		Nson *nson, const char *doc, size_t len, NsonArena *arena) {
+	return plist_parse(nson, doc, len, NULL, arena);
 }
 
 static int
-plist_escape(const Nson *nson, FILE *fd) {
-	off_t i = 0, last_write = 0;
-	size_t len;
-	char *escape = NULL;
+plist_escape(NsonWriter *out, const Nson *nson) {
+	size_t i, n;
+	char *p;
 	const char *str = nson_data(nson);
+	const size_t len = nson_data_len(nson);
 
 	if (str == NULL) {
 		return 0;
 	}
 
-	len = nson_data_len(nson);
-	for (; i < len; i++) {
+	for (i = 0; i < len; i++) {
+		n = __nson_escape_span(&str[i], len - i, NSON_ESCAPE_XML);
+		__nson_writer_write(out, &str[i], n);
+		i += n;
+		if (i == len) {
+			break;
+		}
+
 		switch (str[i]) {
 		case '<':
-			escape = "&lt;";
+			__nson_writer_write(out, "&lt;", 4);
 			break;
 		case '>':
-			escape = "&gt;";
+			__nson_writer_write(out, "&gt;", 4);
 			break;
 		case '&':
-			escape = "&amp;";
+			__nson_writer_write(out, "&amp;", 5);
 			break;
 		default:
-			escape = NULL;
-		}
-		if (escape) {
-			if (fwrite(&str[last_write], sizeof(*str), i - last_write, fd) ==
-				0) {
-				return -1;
-			}
-			if (fputs(escape, fd) == 0) {
-				return -1;
-			}
-			last_write = i + 1;
-		} else if (iscntrl(str[i])) {
-			if (fwrite(&str[last_write], sizeof(*str), i - last_write, fd) ==
-				0) {
-				return -1;
-			}
-			if (fprintf(fd, "&#%02x;", str[i]) == 0) {
-				return -1;
+			// control characters as decimal character references
+			p = __nson_writer_reserve(out, 5);
+			if (p == NULL) {
+				break;
 			}
-			last_write = i + 1;
+			p[0] = '&';
+			p[1] = '#';
+			n = __nson_format_int(&p[2], str[i]);
+			p[2 + n] = ';';
+			out->len += n + 3;
 		}
 	}
 
-	if (i != last_write &&
-		fwrite(&str[last_write], sizeof(*str), i - last_write, fd) == 0) {
-		return -1;
-	}
-
-	return i;
+	return out->error ? -1 : i;
 }
 
 static int
-plist_b64_enc(const Nson *nson, FILE *fd) {
-	int rv = 0;
-	Nson tmp;
-
-	if (nson_clone(&tmp, nson)) {
-		rv = -1;
-	}
-	if (nson_mapper_b64_enc(0, &tmp, NULL) < 0) {
-		rv = -1;
-	} else if (
-			fwrite(nson_data(&tmp), sizeof(char), nson_data_len(&tmp), fd) ==
-			0) {
-		rv = -1;
-	}
-	nson_clean(&tmp);
-	return rv;
+plist_b64_enc(NsonWriter *out, const Nson *nson) {
+	return __nson_writer_write_b64(out, nson_data(nson), nson_data_len(nson));
 }
 
-int
-nson_plist_serialize(
-		char **str, size_t *size, Nson *nson, enum NsonOptions options) {
-	int rv;
-	FILE *out = open_memstream(str, size);
-	if (out == NULL) {
-		return -1;
-	}
-	rv = nson_plist_write(out, nson, options);
-	fclose(out);
-	return rv;
-}
-
-int
-nson_plist_write(FILE *out, const Nson *nson, enum NsonOptions options) {
+static int
+plist_write(NsonWriter *out, const Nson *nson, enum NsonOptions options) {
 	int rv = 0;
+	char *num;
 	static const NsonSerializerInfo info = {
-			.serializer = nson_plist_write,
+			.serializer = plist_write,
 			.seperator = "",
 			.key_value_seperator = "",
 	};
 
 	if (0 == (options & NSON_SKIP_HEADER)) {
-		fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
-			  "<!DOCTYPE plist PUBLIC \"-//Apple Computer//DTD PLIST 1.0//EN\" "
-			  "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">"
-			  "<plist version=\"1.0\">",
-			  out);
+		__nson_writer_puts(
+				out,
+				"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+				"<!DOCTYPE plist PUBLIC \"-//Apple Computer//DTD PLIST 1.0//EN\" "
+				"\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">"
+				"<plist version=\"1.0\">");
 	}
 	switch (nson_type(nson)) {
 	case NSON_NIL:
-		return -1;
+		// plists have no null, it is written as an empty string like JSON
+		// null was before it became NSON_NIL
+		__nson_writer_puts(out, "<string></string>");
 		break;
 	case NSON_STR:
 		if (options & NSON_IS_KEY) {
-			fputs("<key>", out);
-			plist_escape(nson, out);
-			fputs("</key>", out);
+			__nson_writer_puts(out, "<key>");
+			rv = plist_escape(out, nson);
+			__nson_writer_puts(out, "</key>");
 		} else {
-			fputs("<string>", out);
-			plist_escape(nson, out);
-			fputs("</string>", out);
+			__nson_writer_puts(out, "<string>");
+			rv = plist_escape(out, nson);
+			__nson_writer_puts(out, "</string>");
 		}
 		break;
 	case NSON_BLOB:
-		fputs("<data>", out);
-		plist_b64_enc(nson, out);
-		fputs("</data>", out);
+		__nson_writer_puts(out, "<data>");
+		rv = plist_b64_enc(out, nson);
+		__nson_writer_puts(out, "</data>");
 		break;
 	case NSON_REAL:
-		fprintf(out, "<real>%f</real>", nson_real(nson));
+		__nson_writer_puts(out, "<real>");
+		if ((num = __nson_writer_reserve(out, NSON_FORMAT_SIZE))) {
+			out->len += __nson_format_real(num, nson_real(nson));
+		}
+		__nson_writer_puts(out, "</real>");
 		break;
 	case NSON_INT:
-		fprintf(out, "<integer>%" PRId64 "</integer>", nson_int(nson));
+		__nson_writer_puts(out, "<integer>");
+		if ((num = __nson_writer_reserve(out, NSON_FORMAT_SIZE))) {
+			out->len += __nson_format_int(num, nson_int(nson));
+		}
+		__nson_writer_puts(out, "</integer>");
 		break;
 	case NSON_BOOL:
-		fputs(nson_int(nson) ? "<true/>" : "<false/>", out);
+		__nson_writer_puts(out, nson_int(nson) ? "<true/>" : "<false/>");
 		break;
 	case NSON_ARR:
-		fputs("<array>", out);
+		__nson_writer_puts(out, "<array>");
 		rv = __nson_arr_serialize(out, nson, &info, options);
-		fputs("</array>", out);
+		__nson_writer_puts(out, "</array>");
 		break;
 	case NSON_OBJ:
-		fputs("<dict>", out);
+		__nson_writer_puts(out, "<dict>");
 		rv = __nson_obj_serialize(out, nson, &info, options);
-		fputs("</dict>", out);
+		__nson_writer_puts(out, "</dict>");
 		break;
 	default:
 		break;
 	}
 	if (0 == (options & NSON_SKIP_HEADER)) {
-		fputs("</plist>", out);
+		__nson_writer_puts(out, "</plist>");
+	}
+	return out->error ? -1 : rv;
+}
+
+int
+nson_plist_serialize(
+		char **str, size_t *size, Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter out;
+
+	if (__nson_writer_init_mem(&out) < 0) {
+		return -1;
+	}
+	rv = plist_write(&out, nson, options);
+	// Like open_memstream() the output is passed to the caller on error
+	if (__nson_writer_take(&out, str, size) < 0) {
+		rv = -1;
+	}
+	return rv;
+}
+
+int
+nson_plist_write(FILE *out, const Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter writer;
+
+	if (__nson_writer_init_file(&writer, out) < 0) {
+		return -1;
+	}
+	rv = plist_write(&writer, nson, options);
+	if (__nson_writer_finish(&writer) < 0) {
+		rv = -1;
+	}
+	return rv;
+}
+
+int
+nson_plist_write_fd(int fd, const Nson *nson, enum NsonOptions options) {
+	int rv;
+	NsonWriter writer;
+
+	if (__nson_writer_init_fd(&writer, fd) < 0) {
+		return -1;
+	}
+	rv = plist_write(&writer, nson, options);
+	if (__nson_writer_finish(&writer) < 0) {
+		rv = -1;
 	}
 	return rv;
 }
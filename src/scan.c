@@ -0,0 +1,285 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NSON_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The scanner is the first stage of the JSON parser. It classifies the
+ * document in blocks of 64 bytes into bitmasks and turns those into a list
+ * of offsets of all characters the second stage needs to look at:
+ *
+ *  * structural characters ({}[]:,) outside of strings,
+ *  * every unescaped quote, so a string always spans two offsets,
+ *  * the first byte of every scalar (numbers, true, false, null).
+ *
+ * Only the classification depends on the instruction set; everything after
+ * that is plain 64 bit arithmetic.
+ */
+
+enum ScanClass {
+	SCAN_SPACE = 1 << 0,
+	SCAN_OP = 1 << 1,
+	SCAN_QUOTE = 1 << 2,
+	SCAN_BACKSLASH = 1 << 3,
+};
+
+static const uint8_t scan_class[256] = {
+		['\t'] = SCAN_SPACE,	 ['\n'] = SCAN_SPACE, ['\v'] = SCAN_SPACE,
+		['\f'] = SCAN_SPACE,	 ['\r'] = SCAN_SPACE, [' '] = SCAN_SPACE,
+		[','] = SCAN_OP,		 [':'] = SCAN_OP,	  ['['] = SCAN_OP,
+		[']'] = SCAN_OP,		 ['{'] = SCAN_OP,	  ['}'] = SCAN_OP,
+		['"'] = SCAN_QUOTE,		 ['\\'] = SCAN_BACKSLASH,
+};
+
+static void
+classify_scalar(const char *block, NsonScanMasks *masks) {
+	int i;
+	uint64_t bit;
+
+	memset(masks, 0, sizeof(*masks));
+	for (i = 0; i < NSON_SCAN_BLOCK; i++) {
+		bit = 1ULL << i;
+		switch (scan_class[(uint8_t)block[i]]) {
+		case SCAN_SPACE:
+			masks->space |= bit;
+			break;
+		case SCAN_OP:
+			masks->op |= bit;
+			break;
+		case SCAN_QUOTE:
+			masks->quote |= bit;
+			break;
+		case SCAN_BACKSLASH:
+			masks->backslash |= bit;
+			break;
+		}
+	}
+}
+
+#ifdef NSON_SCAN_X86
+/*
+ * Nibble lookup tables for the vectorized classifiers. A byte is looked up
+ * by its low and its high nibble, and the two results are and'ed. Bits 0-1
+ * mark whitespace, bits 2-4 mark structural characters.
+ */
+#define NIBBLE_SPACE 0x03
+#define NIBBLE_OP 0x1c
+#define NIBBLE_LO \
+	0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x09, 0x11, 0x05, 0x11, 0, 0
+#define NIBBLE_HI 0x01, 0, 0x06, 0x08, 0, 0x10, 0, 0x10, 0, 0, 0, 0, 0, 0, 0, 0
+
+__attribute__((target("sse4.2"))) static void
+classify_sse42(const char *block, NsonScanMasks *masks) {
+	int i;
+	uint64_t shift;
+	__m128i chunk, class;
+	const __m128i lo = _mm_setr_epi8(NIBBLE_LO);
+	const __m128i hi = _mm_setr_epi8(NIBBLE_HI);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	memset(masks, 0, sizeof(*masks));
+	for (i = 0; i < NSON_SCAN_BLOCK / 16; i++) {
+		shift = i * 16;
+		chunk = _mm_loadu_si128((const __m128i *)&block[shift]);
+		class = _mm_and_si128(
+				_mm_shuffle_epi8(lo, _mm_and_si128(chunk, nibble)),
+				_mm_shuffle_epi8(
+						hi, _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble)));
+
+		masks->space |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(
+								_mm_and_si128(class, _mm_set1_epi8(NIBBLE_SPACE)),
+								zero))
+				<< shift;
+		masks->op |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(
+							 _mm_and_si128(class, _mm_set1_epi8(NIBBLE_OP)), zero))
+				<< shift;
+		masks->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+								_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')))
+				<< shift;
+		masks->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+									_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')))
+				<< shift;
+	}
+}
+
+__attribute__((target("avx2"))) static void
+classify_avx2(const char *block, NsonScanMasks *masks) {
+	int i;
+	uint64_t shift;
+	__m256i chunk, class;
+	const __m256i lo = _mm256_setr_epi8(NIBBLE_LO, NIBBLE_LO);
+	const __m256i hi = _mm256_setr_epi8(NIBBLE_HI, NIBBLE_HI);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+
+	memset(masks, 0, sizeof(*masks));
+	for (i = 0; i < NSON_SCAN_BLOCK / 32; i++) {
+		shift = i * 32;
+		chunk = _mm256_loadu_si256((const __m256i *)&block[shift]);
+		class = _mm256_and_si256(
+				_mm256_shuffle_epi8(lo, _mm256_and_si256(chunk, nibble)),
+				_mm256_shuffle_epi8(
+						hi,
+						_mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble)));
+
+		masks->space |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(
+								_mm256_cmpeq_epi8(
+										_mm256_and_si256(
+												class,
+												_mm256_set1_epi8(NIBBLE_SPACE)),
+										zero))
+				<< shift;
+		masks->op |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(
+							 _mm256_cmpeq_epi8(
+									 _mm256_and_si256(
+											 class, _mm256_set1_epi8(NIBBLE_OP)),
+									 zero))
+				<< shift;
+		masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+								_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')))
+				<< shift;
+		masks->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+									_mm256_cmpeq_epi8(
+											chunk, _mm256_set1_epi8('\\')))
+				<< shift;
+	}
+}
+#endif
+
+NsonScanClassifier
+__nson_scan_classifier(void) {
+#ifdef NSON_SCAN_X86
+	if (__builtin_cpu_supports("avx2")) {
+		return classify_avx2;
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		return classify_sse42;
+	}
+#endif
+	return classify_scalar;
+}
+
+static uint64_t
+prefix_xor(uint64_t mask) {
+	mask ^= mask << 1;
+	mask ^= mask << 2;
+	mask ^= mask << 4;
+	mask ^= mask << 8;
+	mask ^= mask << 16;
+	mask ^= mask << 32;
+	return mask;
+}
+
+/*
+ * Returns the mask of all characters that are escaped by a backslash. A
+ * backslash escapes the next character only if it is not escaped itself,
+ * so runs of backslashes are resolved by their parity.
+ */
+static uint64_t
+find_escaped(uint64_t backslash, uint64_t *carry) {
+	static const uint64_t odd_bits = 0xaaaaaaaaaaaaaaaaULL;
+	uint64_t potential, codes, escaped;
+
+	if (backslash == 0) {
+		escaped = *carry;
+		*carry = 0;
+		return escaped;
+	}
+
+	potential = backslash & ~*carry;
+	codes = (((potential << 1) | odd_bits) - potential) ^ odd_bits;
+	escaped = codes ^ (backslash | *carry);
+	*carry = (codes & backslash) >> 63;
+	return escaped;
+}
+
+static void
+scan_block(NsonScanner *scan) {
+	char padded[NSON_SCAN_BLOCK];
+	const char *block = &scan->doc[scan->offset];
+	const size_t remaining = scan->len - scan->offset;
+	NsonScanMasks masks;
+	uint64_t escaped, quote, in_string, scalar, structural;
+
+	if (remaining < NSON_SCAN_BLOCK) {
+		memset(padded, ' ', sizeof(padded));
+		memcpy(padded, block, remaining);
+		block = padded;
+	}
+	scan->classify(block, &masks);
+
+	escaped = find_escaped(masks.backslash, &scan->escaped);
+	quote = masks.quote & ~escaped;
+	in_string = prefix_xor(quote) ^ scan->in_string;
+	scan->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+	scalar = ~(masks.op | masks.space | quote);
+	structural = scalar & ~((scalar << 1) | scan->scalar);
+	scan->scalar = scalar >> 63;
+	structural = ((structural | masks.op) & ~in_string) | quote;
+
+	for (; structural; structural &= structural - 1) {
+		scan->index[scan->index_len++] =
+				scan->offset + __builtin_ctzll(structural);
+	}
+	scan->offset += NSON_SCAN_BLOCK;
+}
+
+void
+__nson_scan_init(NsonScanner *scan, const char *doc, size_t len) {
+	memset(scan, 0, offsetof(NsonScanner, index));
+	scan->doc = doc;
+	scan->len = len;
+	scan->classify = __nson_scan_classifier();
+}
+
+off_t
+__nson_scan_next(NsonScanner *scan) {
+	int i;
+
+	while (scan->index_pos == scan->index_len) {
+		if (scan->offset >= scan->len) {
+			return -1;
+		}
+		scan->index_pos = scan->index_len = 0;
+		for (i = 0; i < NSON_SCAN_WINDOW && scan->offset < scan->len; i++) {
+			scan_block(scan);
+		}
+	}
+
+	return scan->index[scan->index_pos++];
+}
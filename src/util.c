@@ -171,33 +171,46 @@ __nson_parse_b64(NsonBuf **dest_buf, const char *src, const size_t len) {
 	return i;
 }
 
-off_t
-__nson_parse_number(Nson *nson, const char *src, size_t len) {
-	off_t i = 0;
-	int64_t i_val = 0;
-	double r_val = 0;
-
-	i = __nson_parse_dev(&i_val, src, len);
-	if (i >= len || src[i] != '.') {
-		nson_int_wrap(nson, i_val);
-		return i;
-	}
-
-	i++;
-	for (r_val = 0; i < len && src[i] >= '0' && src[i] <= '9'; i++) {
-		r_val = (r_val * 0.1) + src[i] - '0';
+/*
+ * Encodes @p len bytes of @p src as padded base64. @p dest must hold
+ * (len + 2) / 3 * 4 bytes.
+ */
+size_t
+__nson_format_b64(char *dest, const char *src, size_t len) {
+	size_t i, j;
+	uint32_t v;
+	const uint8_t *s = (const uint8_t *)src;
+
+	for (i = j = 0; i + 3 <= len; i += 3, j += 4) {
+		v = s[i] << 16 | s[i + 1] << 8 | s[i + 2];
+		dest[j] = base64_table[v >> 18];
+		dest[j + 1] = base64_table[(v >> 12) & 0x3F];
+		dest[j + 2] = base64_table[(v >> 6) & 0x3F];
+		dest[j + 3] = base64_table[v & 0x3F];
 	}
-	r_val *= 0.1;
-
-	if (i_val >= 0) {
-		r_val += i_val;
-	} else {
-		r_val -= i_val;
+	if (i < len) {
+		v = s[i] << 16 | (i + 1 < len ? s[i + 1] << 8 : 0);
+		dest[j] = base64_table[v >> 18];
+		dest[j + 1] = base64_table[(v >> 12) & 0x3F];
+		dest[j + 2] = i + 1 < len ? base64_table[(v >> 6) & 0x3F] : '=';
+		dest[j + 3] = '=';
+		j += 4;
 	}
+	return j;
+}
 
-	nson_real_wrap(nson, r_val);
+/*
+ * FNV-1a hash of @p len bytes of @p data.
+ */
+uint64_t
+__nson_hash(const char *data, size_t len) {
+	size_t i;
+	uint64_t hash = 0xcbf29ce484222325;
 
-	return i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3;
+	}
+	return hash;
 }
 
 off_t
@@ -209,11 +222,17 @@ __nson_to_utf8(char *dest, const uint64_t chr, const size_t len) {
 		dest[0] = ((chr >> 6) & 0x1F) | 0xC0;
 		dest[1] = (chr & 0x3F) | 0x80;
 		return 2;
-	} else if (len >= 3) {
+	} else if (chr < 0x10000 && len >= 3) {
 		dest[0] = ((chr >> 12) & 0x0F) | 0xE0;
 		dest[1] = ((chr >> 6) & 0x3F) | 0x80;
 		dest[2] = (chr & 0x3F) | 0x80;
 		return 3;
+	} else if (chr < 0x110000 && len >= 4) {
+		dest[0] = ((chr >> 18) & 0x07) | 0xF0;
+		dest[1] = ((chr >> 12) & 0x3F) | 0x80;
+		dest[2] = ((chr >> 6) & 0x3F) | 0x80;
+		dest[3] = (chr & 0x3F) | 0x80;
+		return 4;
 	}
 
 	return 0;
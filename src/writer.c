@@ -0,0 +1,301 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * Serializers write into the buffer of an NsonWriter. A writer with a
+ * sink flushes its buffer whenever it is full, a writer without a sink
+ * grows its buffer and hands it over to the caller in the end.
+ */
+
+#define WRITER_BUF_SIZE (64 * 1024)
+/* data of at least this size is passed to fd writers without copying */
+#define WRITER_DIRECT_SIZE (8 * 1024)
+/* input bytes encoded at once by __nson_writer_write_b64() */
+#define WRITER_B64_CHUNK (3 * 1024)
+
+static int
+file_sink(const char *buf, size_t len, void *user_data) {
+	FILE *file = user_data;
+
+	return fwrite(buf, 1, len, file) == len ? 0 : -1;
+}
+
+static int
+fd_sink(const char *buf, size_t len, void *user_data) {
+	int fd = *(int *)user_data;
+	ssize_t rv;
+
+	while (len > 0) {
+		rv = write(fd, buf, len);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv < 0) {
+			return -1;
+		}
+		buf += rv;
+		len -= rv;
+	}
+	return 0;
+}
+
+static int
+fd_writev(int fd, struct iovec *iov, int n) {
+	ssize_t rv;
+
+	while (n > 0) {
+		rv = writev(fd, iov, n);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv < 0) {
+			return -1;
+		}
+		for (; n > 0 && (size_t)rv >= iov->iov_len; iov++, n--) {
+			rv -= iov->iov_len;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + rv;
+			iov->iov_len -= rv;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Writes the buffered output and @p data with a single writev() call, so
+ * large payloads go out from their own storage.
+ */
+static int
+writer_direct(NsonWriter *writer, const char *data, size_t len) {
+	struct iovec iov[] = {
+			{.iov_base = writer->buf, .iov_len = writer->len},
+			{.iov_base = (char *)data, .iov_len = len},
+	};
+
+	if (fd_writev(writer->fd, iov, 2) < 0) {
+		writer->error = true;
+		return -1;
+	}
+	writer->len = 0;
+	return 0;
+}
+
+static int
+writer_alloc(NsonWriter *writer, size_t cap) {
+	memset(writer, 0, sizeof(*writer));
+	writer->buf = malloc(cap);
+	if (writer->buf == NULL) {
+		return -1;
+	}
+	writer->cap = cap;
+	return 0;
+}
+
+int
+__nson_writer_init_mem(NsonWriter *writer) {
+	return writer_alloc(writer, 256);
+}
+
+int
+__nson_writer_init_cb(
+		NsonWriter *writer, NsonWriterSink sink, void *user_data) {
+	if (writer_alloc(writer, WRITER_BUF_SIZE) < 0) {
+		return -1;
+	}
+	writer->sink = sink;
+	writer->user_data = user_data;
+	return 0;
+}
+
+int
+__nson_writer_init_file(NsonWriter *writer, FILE *file) {
+	return __nson_writer_init_cb(writer, file_sink, file);
+}
+
+int
+__nson_writer_init_fd(NsonWriter *writer, int fd) {
+	if (__nson_writer_init_cb(writer, fd_sink, &writer->fd) < 0) {
+		return -1;
+	}
+	writer->fd = fd;
+	return 0;
+}
+
+int
+__nson_writer_flush(NsonWriter *writer) {
+	if (writer->error) {
+		return -1;
+	}
+	if (writer->sink && writer->len) {
+		if (writer->sink(writer->buf, writer->len, writer->user_data) < 0) {
+			writer->error = true;
+			return -1;
+		}
+		writer->len = 0;
+	}
+	return 0;
+}
+
+char *
+__nson_writer_reserve(NsonWriter *writer, size_t len) {
+	char *buf;
+	size_t cap = writer->cap;
+
+	if (writer->error) {
+		return NULL;
+	}
+	if (len <= cap - writer->len) {
+		return &writer->buf[writer->len];
+	}
+	if (writer->sink) {
+		if (__nson_writer_flush(writer) < 0) {
+			return NULL;
+		}
+		if (len <= cap) {
+			return writer->buf;
+		}
+	}
+
+	while (cap - writer->len < len) {
+		if (cap > SIZE_MAX / 2) {
+			errno = ENOMEM;
+			writer->error = true;
+			return NULL;
+		}
+		cap *= 2;
+	}
+	buf = realloc(writer->buf, cap);
+	if (buf == NULL) {
+		writer->error = true;
+		return NULL;
+	}
+	writer->buf = buf;
+	writer->cap = cap;
+	return &writer->buf[writer->len];
+}
+
+int
+__nson_writer_write(NsonWriter *writer, const char *data, size_t len) {
+	char *dest;
+
+	if (writer->error) {
+		return -1;
+	}
+	if (writer->sink == fd_sink && len >= WRITER_DIRECT_SIZE) {
+		return writer_direct(writer, data, len);
+	}
+	if (len <= writer->cap - writer->len) {
+		memcpy(&writer->buf[writer->len], data, len);
+		writer->len += len;
+		return 0;
+	}
+	if (writer->sink && len >= writer->cap) {
+		// Pass large chunks directly to the sink
+		if (__nson_writer_flush(writer) < 0) {
+			return -1;
+		}
+		if (writer->sink(data, len, writer->user_data) < 0) {
+			writer->error = true;
+			return -1;
+		}
+		return 0;
+	}
+	dest = __nson_writer_reserve(writer, len);
+	if (dest == NULL) {
+		return -1;
+	}
+	memcpy(dest, data, len);
+	writer->len += len;
+	return 0;
+}
+
+int
+__nson_writer_write_b64(NsonWriter *writer, const char *data, size_t len) {
+	char *dest;
+	size_t n;
+
+	do {
+		n = len < WRITER_B64_CHUNK ? len : WRITER_B64_CHUNK;
+		dest = __nson_writer_reserve(writer, (n + 2) / 3 * 4);
+		if (dest == NULL) {
+			return -1;
+		}
+		writer->len += __nson_format_b64(dest, data, n);
+		data += n;
+		len -= n;
+	} while (len > 0);
+	return 0;
+}
+
+int
+__nson_writer_puts(NsonWriter *writer, const char *str) {
+	return __nson_writer_write(writer, str, strlen(str));
+}
+
+int
+__nson_writer_putc(NsonWriter *writer, char c) {
+	if (writer->len == writer->cap &&
+		__nson_writer_reserve(writer, 1) == NULL) {
+		return -1;
+	}
+	writer->buf[writer->len++] = c;
+	return 0;
+}
+
+int
+__nson_writer_finish(NsonWriter *writer) {
+	int rv = __nson_writer_flush(writer);
+
+	free(writer->buf);
+	memset(writer, 0, sizeof(*writer));
+	return rv;
+}
+
+int
+__nson_writer_take(NsonWriter *writer, char **str, size_t *size) {
+	assert(writer->sink == NULL);
+
+	if (__nson_writer_putc(writer, '\0') < 0) {
+		__nson_writer_finish(writer);
+		*str = NULL;
+		*size = 0;
+		return -1;
+	}
+	*str = writer->buf;
+	*size = writer->len - 1;
+	memset(writer, 0, sizeof(*writer));
+	return 0;
+}
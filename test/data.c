@@ -93,6 +93,55 @@ check_messy_object() {
 	nson_clean(&nson);
 }
 
+static void
+reserve_array() {
+	int i;
+	Nson nson = {0};
+	nson_init(&nson, NSON_ARR);
+
+	assert(nson_arr_reserve(&nson, 100) == 0);
+	assert(NSON_MEM(nson.a.arr)->cap == 100);
+	for (i = 0; i < 1000; i++) {
+		nson_arr_push_int(&nson, i);
+	}
+	assert(nson_arr_len(&nson) == 1000);
+	assert(NSON_MEM(nson.a.arr)->cap >= 1000);
+
+	assert(nson_shrink_to_fit(&nson) == 0);
+	assert(NSON_MEM(nson.a.arr)->cap == 1000);
+	for (i = 0; i < 1000; i++) {
+		assert(nson_int(nson_arr_get(&nson, i)) == i);
+	}
+
+	nson_clean(&nson);
+}
+
+static void
+reserve_object() {
+	int i;
+	char key[16];
+	Nson nson = {0}, val = {0}, clone = {0};
+	nson_init(&nson, NSON_OBJ);
+
+	assert(nson_obj_reserve(&nson, 10) == 0);
+	assert(NSON_MEM(nson.o.arr)->cap == 10);
+	for (i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%i", i);
+		nson_int_wrap(&val, i);
+		nson_obj_put(&nson, key, &val);
+	}
+	assert(nson_obj_size(&nson) == 100);
+	assert(nson_shrink_to_fit(&nson) == 0);
+	assert(NSON_MEM(nson.o.arr)->cap == 100);
+
+	nson_clone(&clone, &nson);
+	assert(nson_obj_size(&clone) == 100);
+	assert(nson_int(nson_obj_get(&clone, "k42")) == 42);
+
+	nson_clean(&clone);
+	nson_clean(&nson);
+}
+
 static void
 clone_array() {
 	Nson nson = {0}, clone = {0};
@@ -141,14 +190,14 @@ sort_object() {
 	});
 	assert(rv >= 0);
 
-	// before getting, the object will be sorted
+	// lookups keep the order of the keys
 	assert(nson_obj_get(&nson, "not existent") == NULL);
 
-	assert(strcmp(nson_obj_get_key(&nson, 0), "a") == 0);
-	assert(strcmp(nson_obj_get_key(&nson, 1), "b") == 0);
+	assert(strcmp(nson_obj_get_key(&nson, 0), "e") == 0);
+	assert(strcmp(nson_obj_get_key(&nson, 1), "d") == 0);
 	assert(strcmp(nson_obj_get_key(&nson, 2), "c") == 0);
-	assert(strcmp(nson_obj_get_key(&nson, 3), "d") == 0);
-	assert(strcmp(nson_obj_get_key(&nson, 4), "e") == 0);
+	assert(strcmp(nson_obj_get_key(&nson, 3), "b") == 0);
+	assert(strcmp(nson_obj_get_key(&nson, 4), "a") == 0);
 
 	assert(strcmp(nson_str(nson_obj_get(&nson, "a")), "one") == 0);
 	assert(strcmp(nson_str(nson_obj_get(&nson, "b")), "two") == 0);
@@ -336,14 +385,145 @@ issue_concat_empty() {
 	(void)rv;
 }
 
+static void
+index_large_object() {
+	int i;
+	char key[16];
+	Nson nson = {0}, val = {0}, clone = {0};
+	nson_init(&nson, NSON_OBJ);
+
+	for (i = 2000; i > 0; i--) {
+		snprintf(key, sizeof(key), "k%i", i);
+		nson_int_wrap(&val, i);
+		assert(nson_obj_put(&nson, key, &val) == 0);
+	}
+	for (i = 1; i <= 2000; i++) {
+		snprintf(key, sizeof(key), "k%i", i);
+		assert(nson_int(nson_obj_get(&nson, key)) == i);
+	}
+	assert(NSON_MEM(nson.o.arr)->index != NULL);
+	assert(nson_obj_get(&nson, "k0") == NULL);
+	assert(nson_obj_get(&nson, "k") == NULL);
+	assert(nson_obj_get(&nson, "k20000") == NULL);
+
+	// appended keys are added to the index
+	for (i = 2001; i <= 3000; i++) {
+		snprintf(key, sizeof(key), "z%i", i);
+		nson_int_wrap(&val, i);
+		assert(nson_obj_put(&nson, key, &val) == 0);
+		assert(nson_int(nson_obj_get(&nson, key)) == i);
+	}
+	// the last entry of a duplicate key is found
+	nson_int_wrap(&val, -1);
+	assert(nson_obj_put(&nson, "k7", &val) == 0);
+	assert(nson_int(nson_obj_get(&nson, "k7")) == -1);
+	assert(nson_int(nson_obj_get(&nson, "z2500")) == 2500);
+	assert(strcmp(nson_obj_get_key(&nson, 0), "k2000") == 0);
+
+	nson_clone(&clone, &nson);
+	nson_clean(&nson);
+	assert(nson_int(nson_obj_get(&clone, "k1234")) == 1234);
+	assert(nson_obj_size(&clone) == 3001);
+
+	nson_clean(&clone);
+}
+
+static void
+index_keeps_order() {
+	int rv;
+	size_t n;
+	char key[16], *str;
+	Nson nson = {0}, val = {0};
+	const char *doc = "{\"b\":1,\"a\":2,\"d\":3,\"c\":4,\"b\":5}";
+
+	rv = nson_parse_json(&nson, doc, strlen(doc));
+	assert(rv >= 0);
+	assert(nson_obj_get(&nson, "x") == NULL);
+	assert(nson_int(nson_obj_get(&nson, "a")) == 2);
+	assert(nson_int(nson_obj_get(&nson, "b")) == 5);
+	rv = nson_json_serialize(&str, &n, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp(str, doc) == 0);
+	free(str);
+
+	// the sorted index is rebuilt after a put
+	for (int i = 9; i >= 0; i--) {
+		snprintf(key, sizeof(key), "k%i", i);
+		nson_int_wrap(&val, i);
+		assert(nson_obj_put(&nson, key, &val) == 0);
+		assert(nson_int(nson_obj_get(&nson, key)) == i);
+		assert(nson_int(nson_obj_get(&nson, "k9")) == 9);
+		assert(nson_int(nson_obj_get(&nson, "c")) == 4);
+	}
+	assert(NSON_MEM(nson.o.arr)->index != NULL);
+	assert(nson_obj_get(&nson, "k") == NULL);
+	assert(nson_obj_get(&nson, "k10") == NULL);
+	assert(strcmp(nson_obj_get_key(&nson, 5), "k9") == 0);
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+inline_strings() {
+	Nson a = {0}, b = {0}, clone = {0};
+	const char *long_str = "this string does not fit inline";
+
+	assert(nson_init_str(&a, "") == 0);
+	assert(a.c.flags & NSON_FLAG_INLINE);
+	assert(nson_data_len(&a) == 0);
+	assert(strcmp(nson_str(&a), "") == 0);
+	nson_clean(&a);
+
+	assert(nson_init_data(&a, "0123456789012", 13, NSON_STR) == 0);
+	assert(a.c.flags & NSON_FLAG_INLINE);
+	assert(nson_data_len(&a) == 13);
+	assert(nson_init_data(&b, "0123456789012x", 14, NSON_STR) == 0);
+	assert(!(b.c.flags & NSON_FLAG_INLINE));
+	assert(nson_cmp(&a, &b) < 0);
+	assert(nson_cmp(&b, &a) > 0);
+	nson_clean(&b);
+
+	nson_clone(&clone, &a);
+	nson_clean(&a);
+	assert(strcmp(nson_str(&clone), "0123456789012") == 0);
+	nson_clean(&clone);
+
+	nson_init_str(&a, "Hello World");
+	nson_init_str(&b, "Hello World");
+	assert(nson_cmp(&a, &b) == 0);
+	// replacing the data of an inline string
+	nson_mapper_b64_enc(0, &a, NULL);
+	assert(strcmp("SGVsbG8gV29ybGQ=", nson_str(&a)) == 0);
+	nson_clean(&a);
+	nson_clean(&b);
+
+	nson_init_str(&a, long_str);
+	assert(strcmp(nson_str(&a), long_str) == 0);
+	nson_mapper_b64_dec(0, &a, NULL);
+	nson_clean(&a);
+}
+
+static void
+node_size() {
+	assert(sizeof(Nson) == 16);
+	assert(sizeof(NsonObjectEntry) <= 32);
+}
+
 DEFINE
 TEST(create_array);
 TEST(add_int_to_array);
+TEST(reserve_array);
+TEST(reserve_object);
 TEST(clone_array);
 TEST(check_messy_array);
 TEST(check_messy_object);
 TEST(sort_array);
 TEST(sort_object);
+TEST(index_large_object);
+TEST(index_keeps_order);
+TEST(inline_strings);
+TEST(node_size);
 TEST(walk_array_empty);
 TEST(walk_array_tree);
 TEST(issue_nullref);
@@ -0,0 +1,532 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "test.h"
+
+#include "../src/nson.h"
+
+static void
+parse_borrowed_strings() {
+	int rv;
+	NsonDocument doc;
+	Nson *root, *val;
+	char *buf = strdup("{\"plain\": \"abc\", \"escaped\": \"a\\nb\\u0024\"}");
+	const size_t len = strlen(buf);
+
+	rv = nson_doc_parse_json(&doc, buf, len, free);
+	assert(rv == len);
+	root = nson_doc_root(&doc);
+
+	val = nson_obj_get(root, "plain");
+	assert(val != NULL);
+	assert(nson_str(val) >= buf && nson_str(val) < buf + len);
+	assert(strcmp(nson_str(val), "abc") == 0);
+	assert(nson_data_len(val) == 3);
+
+	val = nson_obj_get(root, "escaped");
+	assert(val != NULL);
+	assert(nson_str(val) >= buf && nson_str(val) < buf + len);
+	assert(strcmp(nson_str(val), "a\nb$") == 0);
+	assert(nson_data_len(val) == 4);
+
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+clone_outlives_document() {
+	int rv;
+	NsonDocument doc;
+	Nson clone = {0};
+	char buf[] = "[\"abc\", {\"key\": \"value\"}]";
+
+	rv = nson_doc_parse_json(&doc, buf, strlen(buf), NULL);
+	assert(rv >= 0);
+	nson_clone(&clone, nson_doc_root(&doc));
+	nson_doc_clean(&doc);
+	memset(buf, 'X', sizeof(buf) - 1);
+
+	assert(strcmp(nson_str(nson_arr_get(&clone, 0)), "abc") == 0);
+	assert(strcmp(nson_obj_get_key(nson_arr_get(&clone, 1), 0), "key") == 0);
+	assert(strcmp(nson_str(nson_obj_get(nson_arr_get(&clone, 1), "key")),
+				  "value") == 0);
+
+	nson_clean(&clone);
+	(void)rv;
+}
+
+static void
+clone_escaped_string() {
+	int rv;
+	NsonDocument doc;
+	Nson clone = {0};
+	Nson *root;
+	char buf[] = "[\"abcdefghijklmnop\\\\nq\"]";
+
+	rv = nson_doc_parse_json(&doc, buf, strlen(buf), NULL);
+	assert(rv >= 0);
+	root = nson_doc_root(&doc);
+	nson_clone(&clone, root);
+
+	// decoding the clone must not touch the bytes of the source
+	assert(strcmp(nson_str(nson_arr_get(&clone, 0)), "abcdefghijklmnop\\nq") ==
+		   0);
+	assert(strcmp(nson_str(nson_arr_get(root, 0)), "abcdefghijklmnop\\nq") ==
+		   0);
+	assert(nson_data_len(nson_arr_get(root, 0)) == 19);
+	assert(nson_data_len(nson_arr_get(&clone, 0)) == 19);
+
+	nson_clean(&clone);
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+parse_borrowed_plist() {
+	int rv;
+	NsonDocument doc;
+	Nson *root;
+	char buf[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+				 "<!DOCTYPE plist>"
+				 "<plist><dict><key>k</key><string>a &lt; b</string>"
+				 "</dict></plist>";
+
+	rv = nson_doc_parse_plist(&doc, buf, strlen(buf), NULL);
+	assert(rv >= 0);
+	root = nson_doc_root(&doc);
+	assert(strcmp(nson_obj_get_key(root, 0), "k") == 0);
+	assert(strcmp(nson_str(nson_obj_get(root, "k")), "a < b") == 0);
+
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+load_document() {
+	int rv;
+	NsonDocument doc;
+	char path[] = "/tmp/nson-document-XXXXXX";
+	const char content[] = "[\"hello\", 42]";
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	assert(write(fd, content, sizeof(content) - 1) == sizeof(content) - 1);
+	close(fd);
+
+	rv = nson_doc_load_json(&doc, path);
+	assert(rv >= 0);
+	assert(strcmp(nson_str(nson_arr_get(nson_doc_root(&doc), 0)), "hello") ==
+		   0);
+	assert(nson_int(nson_arr_get(nson_doc_root(&doc), 1)) == 42);
+	nson_doc_clean(&doc);
+
+	unlink(path);
+	(void)rv;
+}
+
+static void
+parse_error_keeps_buffer() {
+	int rv;
+	NsonDocument doc;
+	char buf[] = "[\"abc\"";
+
+	rv = nson_doc_parse_json(&doc, buf, strlen(buf), NULL);
+	assert(rv < 0);
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+arena_parse_json() {
+	int rv;
+	NsonDocument doc;
+	Nson *root, *arr;
+	char *buf = strdup(
+			"{\"s\": \"a\\tb\", \"a\": [1, 2.5, true, {}], \"e\": []}");
+	const size_t len = strlen(buf);
+
+	rv = nson_parse_json_arena(&doc, buf, len);
+	assert(rv == len);
+	// the arena document must not reference its source
+	memset(buf, 'X', len);
+	free(buf);
+
+	root = nson_doc_root(&doc);
+	assert(nson_obj_size(root) == 3);
+	assert(strcmp(nson_str(nson_obj_get(root, "s")), "a\tb") == 0);
+	arr = nson_obj_get(root, "a");
+	assert(nson_arr_len(arr) == 4);
+	assert(nson_int(nson_arr_get(arr, 0)) == 1);
+	assert(nson_real(nson_arr_get(arr, 1)) == 2.5);
+	assert(nson_type(nson_arr_get(arr, 3)) == NSON_OBJ);
+	assert(nson_arr_len(nson_obj_get(root, "e")) == 0);
+
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+arena_read_only() {
+	int rv;
+	NsonDocument doc;
+	Nson clone = {0}, val;
+	char buf[] = "[[1], {\"k\": \"v\"}, []]";
+
+	rv = nson_parse_json_arena(&doc, buf, strlen(buf));
+	assert(rv >= 0);
+
+	nson_int_wrap(&val, 2);
+	rv = nson_arr_push(nson_arr_get(nson_doc_root(&doc), 0), &val);
+	assert(rv < 0);
+	nson_int_wrap(&val, 2);
+	rv = nson_arr_push(nson_arr_get(nson_doc_root(&doc), 2), &val);
+	assert(rv < 0);
+
+	rv = nson_clone(&clone, nson_doc_root(&doc));
+	assert(rv >= 0);
+	nson_doc_clean(&doc);
+
+	nson_int_wrap(&val, 2);
+	rv = nson_arr_push(nson_arr_get(&clone, 0), &val);
+	assert(rv >= 0);
+	nson_int_wrap(&val, 3);
+	rv = nson_arr_push(nson_arr_get(&clone, 2), &val);
+	assert(rv >= 0);
+	assert(nson_arr_len(nson_arr_get(&clone, 0)) == 2);
+	assert(strcmp(nson_str(nson_obj_get(nson_arr_get(&clone, 1), "k")), "v") ==
+		   0);
+
+	nson_clean(&clone);
+	(void)rv;
+}
+
+static void
+arena_parse_plist() {
+	int rv;
+	NsonDocument doc;
+	Nson *root;
+	char buf[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+				 "<!DOCTYPE plist>"
+				 "<plist><dict><key>k</key><string>a &lt; b</string>"
+				 "<key>d</key><data>SGVsbG8=</data>"
+				 "</dict></plist>";
+
+	rv = nson_parse_plist_arena(&doc, buf, strlen(buf));
+	assert(rv >= 0);
+	memset(buf, 'X', sizeof(buf) - 1);
+
+	root = nson_doc_root(&doc);
+	assert(nson_obj_size(root) == 2);
+	assert(strcmp(nson_str(nson_obj_get(root, "k")), "a < b") == 0);
+	assert(nson_data_len(nson_obj_get(root, "d")) == 5);
+	assert(memcmp(nson_data(nson_obj_get(root, "d")), "Hello", 5) == 0);
+
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+arena_large_document() {
+	int rv;
+	size_t i, len = 0;
+	NsonDocument doc;
+	const size_t count = 100000;
+	char *buf = malloc(count * 16 + 2);
+
+	buf[len++] = '[';
+	for (i = 0; i < count; i++) {
+		len += sprintf(&buf[len], "%s[\"%06zu\"]", i ? "," : "", i);
+	}
+	buf[len++] = ']';
+
+	rv = nson_parse_json_arena(&doc, buf, len);
+	assert(rv == len);
+	assert(nson_arr_len(nson_doc_root(&doc)) == count);
+	assert(strcmp(nson_str(nson_arr_get(
+						  nson_arr_get(nson_doc_root(&doc), count - 1), 0)),
+				  "099999") == 0);
+
+	nson_doc_clean(&doc);
+	free(buf);
+	(void)rv;
+}
+
+static void
+arena_large_object() {
+	int rv;
+	size_t i, len = 0;
+	char key[16];
+	NsonDocument doc;
+	Nson *root;
+	char *buf = malloc(200 * 16 + 2);
+
+	buf[len++] = '{';
+	for (i = 0; i < 200; i++) {
+		len += sprintf(&buf[len], "%s\"k%zu\":%zu", i ? "," : "", 199 - i, i);
+	}
+	buf[len++] = '}';
+
+	rv = nson_parse_json_arena(&doc, buf, len);
+	assert(rv == len);
+	root = nson_doc_root(&doc);
+	for (i = 0; i < 200; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		assert(nson_int(nson_obj_get(root, key)) == 199 - i);
+	}
+	assert(nson_obj_get(root, "k200") == NULL);
+	assert(strcmp(nson_obj_get_key(root, 0), "k199") == 0);
+
+	nson_doc_clean(&doc);
+	free(buf);
+	(void)rv;
+}
+
+static void
+arena_parse_error() {
+	int rv;
+	NsonDocument doc;
+	char buf[] = "[\"abc\", [1, 2]";
+
+	rv = nson_parse_json_arena(&doc, buf, strlen(buf));
+	assert(rv < 0);
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+lazy_parse_json() {
+	int rv;
+	NsonDocument doc;
+	Nson *root, *val;
+	char buf[] = " {\"skip\": [[1, \"]\"], {\"x\": \"}\"}], \"n\": -1.5, "
+				 "\"esc\": \"a\\nb\", \"obj\": {\"arr\": [1, true, null]}} ";
+
+	rv = nson_doc_parse_json_lazy(&doc, buf, strlen(buf), NULL);
+	assert(rv == strlen(buf) - 1);
+	root = nson_doc_root(&doc);
+	assert(nson_type(root) == NSON_OBJ);
+
+	assert(nson_real(nson_obj_get(root, "n")) == -1.5);
+	assert(strcmp(nson_str(nson_obj_get(root, "esc")), "a\nb") == 0);
+	val = nson_obj_get(nson_obj_get(root, "obj"), "arr");
+	assert(nson_type(val) == NSON_ARR);
+	assert(nson_arr_len(val) == 3);
+	assert(nson_int(nson_arr_get(val, 0)) == 1);
+	assert(nson_type(nson_arr_get(val, 2)) == NSON_NIL);
+	assert(nson_obj_size(root) == 4);
+
+	nson_doc_clean(&doc);
+	(void)rv;
+}
+
+static void
+lazy_matches_eager() {
+	int rv;
+	NsonDocument doc;
+	Nson nson = {0};
+	size_t size;
+	char *expected, *result;
+	char buf[] = "[{\"a\": [1, 2, {\"b\": [\"c\\\"d\", 1e3]}]}, [], {}, "
+				 "\"\\u00e4\", [[[[false]]]]]";
+
+	rv = nson_parse_json(&nson, buf, strlen(buf));
+	assert(rv >= 0);
+	rv = nson_json_serialize(&expected, &size, &nson, 0);
+	assert(rv >= 0);
+	nson_clean(&nson);
+
+	rv = nson_doc_parse_json_lazy(&doc, buf, strlen(buf), NULL);
+	assert(rv >= 0);
+	// read a part of the tree before the rest is copied
+	assert(nson_obj_size(nson_arr_get(nson_doc_root(&doc), 0)) == 1);
+	rv = nson_clone(&nson, nson_doc_root(&doc));
+	assert(rv >= 0);
+	nson_doc_clean(&doc);
+
+	rv = nson_json_serialize(&result, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp(expected, result) == 0);
+	nson_clean(&nson);
+
+	free(expected);
+	free(result);
+	(void)rv;
+}
+
+static void
+lazy_clone_deep() {
+	int rv;
+	size_t i;
+	NsonDocument doc;
+	Nson nson = {0}, *value;
+	const size_t depth = 20000;
+	char *buf = malloc(2 * depth + 1);
+
+	assert(buf);
+	memset(buf, '[', depth);
+	memset(&buf[depth], ']', depth);
+	buf[2 * depth] = '\0';
+
+	rv = nson_doc_parse_json_lazy(&doc, buf, 2 * depth, free);
+	assert(rv >= 0);
+	// the lazy root is copied in a single pass
+	rv = nson_clone(&nson, nson_doc_root(&doc));
+	assert(rv >= 0);
+	nson_doc_clean(&doc);
+
+	for (i = 1, value = &nson; i < depth; i++) {
+		assert(nson_arr_len(value) == 1);
+		value = nson_arr_get(value, 0);
+	}
+	assert(nson_arr_len(value) == 0);
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+lazy_invalid_subtree() {
+	int rv;
+	NsonDocument doc;
+	Nson *root;
+	char buf[] = "{\"bad\": [1, tru], \"good\": 1, \"key\": {1: 2}}";
+	char unbalanced[] = "[1, [2, 3]";
+
+	rv = nson_doc_parse_json_lazy(&doc, buf, strlen(buf), NULL);
+	assert(rv >= 0);
+	root = nson_doc_root(&doc);
+	assert(nson_int(nson_obj_get(root, "good")) == 1);
+	assert(nson_arr_len(nson_obj_get(root, "bad")) == 0);
+	assert(nson_obj_size(nson_obj_get(root, "key")) == 0);
+	nson_doc_clean(&doc);
+
+	rv = nson_doc_parse_json_lazy(&doc, unbalanced, strlen(unbalanced), NULL);
+	assert(rv < 0);
+	(void)rv;
+}
+
+static void
+ctx_parse_reuse() {
+	int rv;
+	size_t len;
+	char buf[128];
+	Nson nson, *root;
+	NsonParseContext ctx;
+	struct NsonArenaChunk *chunks = NULL;
+
+	nson_parse_ctx_init(&ctx);
+	for (int i = 0; i < 1000; i++) {
+		len = sprintf(
+				buf, "{\"id\": %i, \"name\": \"n\\u0041\", \"tags\": [1, [%i]]}",
+				i, i);
+		rv = nson_parse_json_ctx(&ctx, &nson, buf, len);
+		assert(rv == len);
+		memset(buf, 'X', len);
+
+		root = &nson;
+		assert(nson_int(nson_obj_get(root, "id")) == i);
+		assert(strcmp(nson_str(nson_obj_get(root, "name")), "nA") == 0);
+		assert(nson_int(nson_arr_get(
+					   nson_arr_get(nson_obj_get(root, "tags"), 1), 0)) == i);
+		// the arena is reused once it has grown to the document
+		if (i == 1) {
+			chunks = ctx.arena.chunks;
+		} else if (i > 1) {
+			assert(ctx.arena.chunks == chunks);
+		}
+	}
+	nson_clean(&nson);
+	nson_parse_ctx_clean(&ctx);
+	(void)rv;
+}
+
+static void
+ctx_parse_large_and_errors() {
+	int rv;
+	size_t i, len = 0;
+	Nson nson, clone;
+	NsonParseContext ctx;
+	const size_t count = 100000;
+	char *buf = malloc(count * 16 + 2);
+	struct NsonArenaChunk *chunks;
+
+	buf[len++] = '[';
+	for (i = 0; i < count; i++) {
+		len += sprintf(&buf[len], "%s[\"%06zu\"]", i ? "," : "", i);
+	}
+	buf[len++] = ']';
+
+	nson_parse_ctx_init(&ctx);
+	rv = nson_parse_json_ctx(&ctx, &nson, buf, len);
+	assert(rv == len);
+	rv = nson_parse_json_ctx(&ctx, &nson, buf, len);
+	assert(rv == len);
+	chunks = ctx.arena.chunks;
+	rv = nson_parse_json_ctx(&ctx, &nson, buf, len);
+	assert(rv == len);
+	assert(ctx.arena.chunks == chunks);
+	assert(nson_arr_len(&nson) == count);
+
+	rv = nson_parse_json_ctx(&ctx, &nson, NSON_P("[\"abc\", [1, 2]"));
+	assert(rv < 0);
+	rv = nson_parse_json_ctx(&ctx, &nson, NSON_P("{\"k\": [\"v\"]}"));
+	assert(rv >= 0);
+	rv = nson_clone(&clone, &nson);
+	assert(rv >= 0);
+	nson_parse_ctx_clean(&ctx);
+
+	assert(strcmp(nson_str(nson_arr_get(nson_obj_get(&clone, "k"), 0)), "v") ==
+		   0);
+
+	nson_clean(&clone);
+	free(buf);
+	(void)rv;
+}
+
+DEFINE
+TEST(parse_borrowed_strings);
+TEST(clone_outlives_document);
+TEST(clone_escaped_string);
+TEST(parse_borrowed_plist);
+TEST(load_document);
+TEST(parse_error_keeps_buffer);
+TEST(arena_parse_json);
+TEST(arena_read_only);
+TEST(arena_parse_plist);
+TEST(arena_large_document);
+TEST(arena_large_object);
+TEST(arena_parse_error);
+TEST(lazy_parse_json);
+TEST(lazy_matches_eager);
+TEST(lazy_clone_deep);
+TEST(lazy_invalid_subtree);
+TEST(ctx_parse_reuse);
+TEST(ctx_parse_large_and_errors);
+DEFINE_END
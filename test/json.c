@@ -32,6 +32,8 @@
 
 #include "../src/nson.h"
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
 
 static void
 parse_true() {
@@ -73,6 +75,98 @@ parse_number() {
 	(void)rv;
 }
 
+static void
+parse_exponent() {
+	int rv;
+	Nson nson = {0};
+
+	rv = NSON(&nson, [ 1e10, 2.5E-3, -4e+2, 1e400, 5e-324 ]);
+	assert(rv >= 0);
+	assert(nson_type(nson_arr_get(&nson, 0)) == NSON_REAL);
+	assert(nson_real(nson_arr_get(&nson, 0)) == 1e10);
+	assert(nson_real(nson_arr_get(&nson, 1)) == 2.5e-3);
+	assert(nson_real(nson_arr_get(&nson, 2)) == -400.0);
+	assert(nson_real(nson_arr_get(&nson, 3)) == HUGE_VAL);
+	assert(nson_real(nson_arr_get(&nson, 4)) == 5e-324);
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_negative_real() {
+	int rv;
+	Nson nson = {0};
+
+	rv = NSON(&nson, [ -1.5, -0.25, -0.0 ]);
+	assert(rv >= 0);
+	assert(nson_real(nson_arr_get(&nson, 0)) == -1.5);
+	assert(nson_real(nson_arr_get(&nson, 1)) == -0.25);
+	assert(signbit(nson_real(nson_arr_get(&nson, 2))));
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_real_correctly_rounded() {
+	int rv;
+	Nson nson = {0};
+
+	rv = NSON(&nson, [
+		0.1, 0.30000000000000004, 1.7976931348623157e308,
+		2.2250738585072014e-308, 1e23, 123456789012345678901234567890
+	]);
+	assert(rv >= 0);
+	assert(nson_real(nson_arr_get(&nson, 0)) == 0.1);
+	assert(nson_real(nson_arr_get(&nson, 1)) == 0.30000000000000004);
+	assert(nson_real(nson_arr_get(&nson, 2)) == 1.7976931348623157e308);
+	assert(nson_real(nson_arr_get(&nson, 3)) == 2.2250738585072014e-308);
+	assert(nson_real(nson_arr_get(&nson, 4)) == 1e23);
+	assert(nson_real(nson_arr_get(&nson, 5)) ==
+		   123456789012345678901234567890.0);
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_int_overflow() {
+	int rv;
+	Nson nson = {0};
+
+	rv = NSON(&nson, [
+		9223372036854775807, -9223372036854775808, 9223372036854775808
+	]);
+	assert(rv >= 0);
+	assert(nson_type(nson_arr_get(&nson, 0)) == NSON_INT);
+	assert(nson_int(nson_arr_get(&nson, 0)) == INT64_MAX);
+	assert(nson_type(nson_arr_get(&nson, 1)) == NSON_INT);
+	assert(nson_int(nson_arr_get(&nson, 1)) == INT64_MIN);
+	assert(nson_type(nson_arr_get(&nson, 2)) == NSON_REAL);
+	assert(nson_real(nson_arr_get(&nson, 2)) == 9223372036854775808.0);
+
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_invalid_number() {
+	int rv;
+	Nson nson = {0};
+
+	rv = NSON(&nson, [1.]);
+	assert(rv < 0);
+	rv = NSON(&nson, [1e]);
+	assert(rv < 0);
+	rv = NSON(&nson, [-]);
+	assert(rv < 0);
+	rv = NSON(&nson, [1.5e+]);
+	assert(rv < 0);
+
+	(void)rv;
+}
+
 static void
 parse_empty_string() {
 	int rv;
@@ -110,6 +204,83 @@ parse_string_escape_newline2() {
 	(void)rv;
 }
 
+static void
+parse_string_escaped_quote() {
+	int rv;
+	Nson nson;
+	rv = nson_parse_json(&nson, NSON_P("[\"a\\\\\\\"b\", \"c\\\\\"]"));
+	assert(rv >= 0);
+	assert(nson_arr_len(&nson) == 2);
+	assert(strcmp("a\\\"b", nson_str(nson_arr_get(&nson, 0))) == 0);
+	assert(strcmp("c\\", nson_str(nson_arr_get(&nson, 1))) == 0);
+	nson_clean(&nson);
+
+	(void)rv;
+}
+
+static void
+parse_string_lazy_unescape() {
+	int rv;
+	Nson nson, clone, expected;
+	rv = nson_parse_json(&nson, NSON_P("[\"a\\tb\\u00a2\", \"a\\tb\\u00a2\"]"));
+	assert(rv >= 0);
+	nson_init_str(&expected, "a\tb\u00a2");
+
+	// a clone shares the undecoded buffer of the original
+	nson_clone(&clone, nson_arr_get(&nson, 0));
+	assert(nson_cmp(nson_arr_get(&nson, 1), &expected) == 0);
+	assert(nson_data_len(nson_arr_get(&nson, 0)) == 5);
+	assert(strcmp(nson_str(&clone), "a\tb\u00a2") == 0);
+	assert(nson_data_len(&clone) == 5);
+
+	nson_clean(&expected);
+	nson_clean(&clone);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_string_across_blocks() {
+	int rv;
+	Nson nson;
+	char doc[512] = "[1, \"";
+	size_t len;
+
+	memset(&doc[5], 'a', 300);
+	strcpy(&doc[305], "\\\"\", [true, {\"b\" : null}], false ]");
+	len = strlen(doc);
+
+	rv = nson_parse_json(&nson, doc, len);
+	assert(rv == len);
+	assert(nson_arr_len(&nson) == 4);
+	assert(nson_data_len(nson_arr_get(&nson, 1)) == 301);
+	assert(nson_str(nson_arr_get(&nson, 1))[300] == '"');
+	assert(nson_int(nson_arr_get(nson_arr_get(&nson, 2), 0)) == 1);
+	assert(nson_int(nson_arr_get(&nson, 3)) == 0);
+	nson_clean(&nson);
+
+	(void)rv;
+}
+
+static void
+trailing_garbage_in_scalar() {
+	int rv;
+	Nson nson;
+	rv = nson_parse_json(&nson, NSON_P("[1x]"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	rv = nson_parse_json(&nson, NSON_P("[truex]"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	rv = nson_parse_json(&nson, NSON_P("nul"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	(void)rv;
+}
+
 static void
 object_with_one_element() {
 	int rv;
@@ -148,6 +319,46 @@ object_with_multiple_elements() {
 	(void)e2;
 }
 
+static void
+parse_wide_array() {
+	int rv;
+	Nson nson;
+	const int count = 100000;
+	char *doc = malloc(count * 8 + 2), *p = doc;
+
+	*p++ = '[';
+	for (int i = 0; i < count; i++) {
+		p += sprintf(p, i ? ",%i" : "%i", i);
+	}
+	*p++ = ']';
+
+	rv = nson_parse_json(&nson, doc, p - doc);
+	assert(rv == p - doc);
+	assert(nson_arr_len(&nson) == count);
+	for (int i = 0; i < count; i++) {
+		assert(nson_int(nson_arr_get(&nson, i)) == i);
+	}
+	nson_clean(&nson);
+	free(doc);
+
+	(void)rv;
+}
+
+static void
+mismatched_brackets() {
+	int rv;
+	Nson nson;
+	rv = nson_parse_json(&nson, NSON_P("[1, 2}"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	rv = nson_parse_json(&nson, NSON_P("{\"a\": 1]"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	(void)rv;
+}
+
 static void
 access_str_as_arr() {
 	int rv;
@@ -354,6 +565,81 @@ stringify_nullbyte() {
 	(void)rv;
 }
 
+static void
+stringify_escapes() {
+	int rv;
+	char *str;
+	size_t size;
+	Nson nson, parsed;
+	const char input[] = "a\\b\"c\x01\b\f\n\t\r/";
+
+	rv = nson_init_data(&nson, input, sizeof(input) - 1, NSON_STR);
+	assert(rv >= 0);
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp(str, "\"a\\\\b\\\"c\\u0001\\b\\f\\n\\t\\r/\"") == 0);
+
+	rv = nson_parse_json(&parsed, str, size);
+	assert(rv >= 0);
+	assert(nson_data_len(&parsed) == sizeof(input) - 1);
+	assert(memcmp(nson_data(&parsed), input, sizeof(input) - 1) == 0);
+
+	nson_clean(&parsed);
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+stringify_escapes_long() {
+	int rv;
+	size_t i;
+	char *str;
+	size_t size;
+	Nson nson;
+	char input[200], expected[256];
+
+	// escapes at every position of the vectorized blocks
+	for (i = 0; i < 100; i++) {
+		memset(input, 'x', 100);
+		input[i] = '"';
+		rv = nson_init_data(&nson, input, 100, NSON_STR);
+		assert(rv >= 0);
+		rv = nson_json_serialize(&str, &size, &nson, 0);
+		assert(rv >= 0);
+		snprintf(expected, sizeof(expected), "\"%.*s\\\"%.*s\"", (int)i, input,
+				 (int)(99 - i), &input[i + 1]);
+		assert(strcmp(str, expected) == 0);
+		free(str);
+		nson_clean(&nson);
+	}
+	(void)rv;
+}
+
+static void
+stringify_ascii() {
+	int rv;
+	char *str;
+	size_t size;
+	Nson nson, parsed;
+	const char input[] = "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80";
+
+	rv = nson_init_str(&nson, input);
+	assert(rv >= 0);
+	rv = nson_json_serialize(&str, &size, &nson, NSON_ASCII);
+	assert(rv >= 0);
+	assert(strcmp(str, "\"caf\\u00e9 \\u20ac \\ud83d\\ude00\"") == 0);
+
+	rv = nson_parse_json(&parsed, str, size);
+	assert(rv >= 0);
+	assert(strcmp(nson_str(&parsed), input) == 0);
+
+	nson_clean(&parsed);
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
 static void
 stringify_empty_array() {
 	int rv;
@@ -412,6 +698,94 @@ stringify_object() {
 	(void)rv;
 }
 
+static void
+stringify_numbers() {
+	int rv;
+	Nson nson;
+	char *str;
+	size_t size;
+
+	rv = NSON(&nson, [
+		0.1, -2.5, 1e300, 5e-324, 100.0, 0.000001, -42, 9223372036854775807
+	]);
+	assert(rv >= 0);
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp("[0.1,-2.5,1e300,5e-324,100.0,0.000001,-42,"
+				  "9223372036854775807]",
+				  str) == 0);
+	free(str);
+	nson_clean(&nson);
+
+	nson_real_wrap(&nson, 1.0 / 0.0);
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp("null", str) == 0);
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+stringify_real_roundtrip() {
+	int rv;
+	size_t i;
+	Nson nson, parsed;
+	char *str;
+	size_t size;
+	const double values[] = {
+			0.1, 1.0 / 3, 2.2250738585072014e-308, 1.7976931348623157e308,
+			123456.789, -9.87654321e-7};
+
+	for (i = 0; i < sizeof(values) / sizeof(*values); i++) {
+		nson_real_wrap(&nson, values[i]);
+		rv = nson_json_serialize(&str, &size, &nson, 0);
+		assert(rv >= 0);
+		rv = nson_parse_json(&parsed, str, size);
+		assert(rv >= 0);
+		assert(nson_type(&parsed) == NSON_REAL);
+		assert(nson_real(&parsed) == values[i]);
+		free(str);
+		nson_clean(&parsed);
+		nson_clean(&nson);
+	}
+	(void)rv;
+}
+
+static void
+write_file() {
+	int rv;
+	size_t i, size;
+	Nson nson, val;
+	char *str, *read_back;
+	FILE *file = tmpfile();
+
+	assert(file != NULL);
+	nson_init_arr(&nson);
+	for (i = 0; i < 100000; i++) {
+		nson_init_str(&val, "abcdefghijklmnop");
+		nson_arr_push(&nson, &val);
+	}
+
+	rv = nson_json_write(file, &nson, 0);
+	assert(rv >= 0);
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strlen(str) == size);
+
+	assert(ftell(file) == size);
+	rewind(file);
+	read_back = malloc(size);
+	assert(fread(read_back, 1, size, file) == size);
+	assert(memcmp(str, read_back, size) == 0);
+
+	free(read_back);
+	free(str);
+	fclose(file);
+	nson_clean(&nson);
+	(void)rv;
+}
+
 void
 stringify_data() {
 	int rv;
@@ -458,15 +832,846 @@ INPUT_CHECK(fuzz_parse_deadlock, json, "{{99999999999999999999999999T]]]")
 
 INPUT_CHECK(fuzz_parse_crash_closing_bracket, json, {']'})
 
+static int
+parse_chunked(Nson *nson, const char *doc, size_t len, size_t chunk_size) {
+	int rv = 0;
+	size_t i, n;
+	NsonJsonParser parser;
+
+	nson_json_parser_init(&parser);
+	for (i = 0; i < len && rv >= 0; i += n) {
+		n = len - i < chunk_size ? len - i : chunk_size;
+		rv = nson_json_parser_feed(&parser, &doc[i], n);
+	}
+	if (rv < 0) {
+		nson_json_parser_clean(&parser);
+		return rv;
+	}
+	return nson_json_parser_finish(&parser, nson);
+}
+
+static void
+incremental_parse_chunks() {
+	int rv;
+	size_t chunk_size, size;
+	char *expected, *result;
+	Nson nson = {0};
+	static const char doc[] = "{\"key\": [1, -2.5e3, true, false, null, "
+							  "\"esc\\\"aped \\\\\", \"\\u00e4\\ud83d\\ude00\"],"
+							  " \"nested\": {\"a\": [[], {}]}, \"n\": 12345678901}";
+
+	rv = nson_parse_json(&nson, doc, strlen(doc));
+	assert(rv >= 0);
+	rv = nson_json_serialize(&expected, &size, &nson, 0);
+	assert(rv >= 0);
+	nson_clean(&nson);
+
+	for (chunk_size = 1; chunk_size <= strlen(doc); chunk_size++) {
+		rv = parse_chunked(&nson, doc, strlen(doc), chunk_size);
+		assert(rv >= 0);
+		rv = nson_json_serialize(&result, &size, &nson, 0);
+		assert(rv >= 0);
+		assert(strcmp(expected, result) == 0);
+		free(result);
+		nson_clean(&nson);
+	}
+	free(expected);
+	(void)rv;
+}
+
+static void
+incremental_parse_scalar() {
+	int rv;
+	Nson nson = {0};
+
+	rv = parse_chunked(&nson, "12345", 5, 2);
+	assert(rv >= 0);
+	assert(nson_type(&nson) == NSON_INT);
+	assert(nson_int(&nson) == 12345);
+	nson_clean(&nson);
+
+	rv = parse_chunked(&nson, " \"a\\\"b\" \n", 9, 1);
+	assert(rv >= 0);
+	assert(nson_type(&nson) == NSON_STR);
+	assert(strcmp(nson_str(&nson), "a\"b") == 0);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+incremental_parse_errors() {
+	int rv;
+	Nson nson = {0};
+	size_t chunk_size;
+	static const char *const docs[] = {
+			"[1, 2", "\"unterminated", "[1] 2", "[1}", "{\"a\"}", "tru",
+			"[nul]", "1.", "",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(docs) / sizeof(*docs); i++) {
+		for (chunk_size = 1; chunk_size <= 3; chunk_size++) {
+			rv = parse_chunked(&nson, docs[i], strlen(docs[i]), chunk_size);
+			assert(rv < 0);
+		}
+	}
+	(void)rv;
+}
+
+static void
+incremental_parse_non_string_keys() {
+	int rv;
+	Nson nson = {0};
+	size_t chunk_size;
+	static const char *const docs[] = {
+			"{1:2}", "{null:1}", "{[]:1}", "{{}:1}", "{\"a\":1,true:2}",
+			"[{\"a\":{2:3}}]",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(docs) / sizeof(*docs); i++) {
+		rv = nson_parse_json(&nson, docs[i], strlen(docs[i]));
+		assert(rv < 0);
+		for (chunk_size = 1; chunk_size <= 3; chunk_size++) {
+			rv = parse_chunked(&nson, docs[i], strlen(docs[i]), chunk_size);
+			assert(rv < 0);
+		}
+	}
+
+	// values may be of any type
+	rv = parse_chunked(&nson, "{\"a\":[1],\"b\":{\"c\":null}}", 24, 2);
+	assert(rv >= 0);
+	assert(nson_type(nson_obj_get(&nson, "b")) == NSON_OBJ);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+struct EventCounter {
+	int depth;
+	int max_depth;
+	int keys;
+	int strings;
+	int64_t sum;
+	bool has_escaped_string;
+};
+
+static int
+count_begin(void *user_data) {
+	struct EventCounter *c = user_data;
+	if (++c->depth > c->max_depth) {
+		c->max_depth = c->depth;
+	}
+	return 0;
+}
+
+static int
+count_end(void *user_data) {
+	struct EventCounter *c = user_data;
+	c->depth--;
+	return 0;
+}
+
+static int
+count_key(void *user_data, const char *str, size_t len) {
+	struct EventCounter *c = user_data;
+	c->keys++;
+	return len == 5 && memcmp(str, "abort", 5) == 0 ? -1 : 0;
+}
+
+static int
+count_string(void *user_data, const char *str, size_t len) {
+	char buf[16];
+	struct EventCounter *c = user_data;
+
+	c->strings++;
+	if (memchr(str, '\\', len) != NULL) {
+		assert(len < sizeof(buf));
+		len = nson_json_unescape(buf, str, len);
+		assert(len == 3);
+		assert(memcmp(buf, "a\"b", 3) == 0);
+		c->has_escaped_string = true;
+	}
+	return 0;
+}
+
+static int
+count_integer(void *user_data, int64_t value) {
+	struct EventCounter *c = user_data;
+	c->sum += value;
+	return 0;
+}
+
+static const NsonJsonEvents count_events = {
+		.begin_array = count_begin,
+		.end_array = count_end,
+		.begin_object = count_begin,
+		.end_object = count_end,
+		.key = count_key,
+		.string = count_string,
+		.integer = count_integer,
+};
+
+static void
+events_parse() {
+	int rv;
+	struct EventCounter c = {0};
+	static const char doc[] = "{\"a\": [1, 2, {\"b\": 3}], \"c\": \"x\", "
+							  "\"d\": [\"a\\\"b\", 1.5, null, true]} trailing";
+
+	rv = nson_parse_json_events(doc, strlen(doc), &count_events, &c);
+	assert(rv == strlen(doc) - strlen(" trailing"));
+	assert(c.depth == 0);
+	assert(c.max_depth == 3);
+	assert(c.keys == 4);
+	assert(c.strings == 2);
+	assert(c.sum == 6);
+	assert(c.has_escaped_string);
+	(void)rv;
+}
+
+static void
+events_abort() {
+	int rv;
+	struct EventCounter c = {0};
+	static const char doc[] = "{\"a\": 1, \"abort\": 2, \"b\": 3}";
+
+	rv = nson_parse_json_events(doc, strlen(doc), &count_events, &c);
+	assert(rv < 0);
+	assert(c.keys == 2);
+	assert(c.sum == 1);
+	(void)rv;
+}
+
+static void
+events_invalid() {
+	int rv;
+	struct EventCounter c = {0};
+	Nson nson = {0};
+
+	rv = nson_parse_json_events("[1, 2", 5, &count_events, &c);
+	assert(rv < 0);
+	rv = nson_parse_json_events("{1: 2}", 6, &count_events, &c);
+	assert(rv < 0);
+	rv = nson_parse_json_events("{\"a\"}", 5, &count_events, &c);
+	assert(rv < 0);
+	rv = nson_parse_json_events("[1}", 3, &count_events, &c);
+	assert(rv < 0);
+	rv = NSON(&nson, {1 : 2});
+	assert(rv < 0);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+thread_parse_array() {
+	int rv;
+	size_t i, len = 0, size;
+	char *doc = NULL, *expected, *result;
+	Nson nson = {0};
+	FILE *stream = open_memstream(&doc, &len);
+	NsonThreadMapSettings settings = {
+			.threads = 4,
+			.chunk_size = 100,
+	};
+
+	fputs(" [", stream);
+	for (i = 0; i < 500; i++) {
+		fprintf(stream,
+				"%s{\"id\": %zu, \"s\": \"],[{\\\"%zu\\\", \\\\\", "
+				"\"a\": [[%zu, {}], []]}\n",
+				i ? "," : "", i, i, i);
+	}
+	fputs("] ", stream);
+	fclose(stream);
+
+	rv = nson_parse_json(&nson, doc, len);
+	assert(rv >= 0);
+	rv = nson_json_serialize(&expected, &size, &nson, 0);
+	assert(rv >= 0);
+	nson_clean(&nson);
+
+	rv = nson_parse_json_thread_ext(&settings, &nson, doc, len);
+	assert(rv == len - 1);
+	assert(nson_arr_len(&nson) == 500);
+	rv = nson_json_serialize(&result, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp(expected, result) == 0);
+	nson_clean(&nson);
+
+	free(result);
+	free(expected);
+	free(doc);
+	(void)rv;
+}
+
+static void
+thread_parse_errors() {
+	int rv;
+	Nson nson = {0};
+	size_t i;
+	static const char *const docs[] = {
+			"[1, 2, 3, {\"a\"}, 5, 6]", "[1, 2, 3, [4}, 5, 6]",
+			"[1, 2, 3, 4, 5, 6", "[1, 2, 3], 4, 5, 6]",
+			"[1, 2, \"3, 4, 5, 6]", "[1, 2, 3, 4, 5, 6}",
+	};
+	NsonThreadMapSettings settings = {
+			.threads = 2,
+			.chunk_size = 1,
+	};
+
+	for (i = 0; i < sizeof(docs) / sizeof(*docs); i++) {
+		rv = nson_parse_json_thread_ext(
+				&settings, &nson, docs[i], strlen(docs[i]));
+		if (i == 3) {
+			// like nson_parse_json(), only the root array is parsed
+			assert(rv == 9);
+			assert(nson_arr_len(&nson) == 3);
+			nson_clean(&nson);
+		} else {
+			assert(rv < 0);
+		}
+	}
+
+	rv = nson_parse_json_thread_ext(&settings, &nson, NSON_P("{\"a\": 1}"));
+	assert(rv >= 0);
+	assert(nson_int(nson_obj_get(&nson, "a")) == 1);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void *
+read_escaped(void *arg) {
+	const char *str = nson_str(nson_arr_get(arg, 0));
+
+	return strcmp(str, "\\u0041 is not decoded twice") == 0 ? arg : NULL;
+}
+
+static void
+clone_read_concurrently() {
+	int rv, i;
+	void *ok;
+	pthread_t thread;
+	Nson nson, clone;
+	const char doc[] = "[\"\\\\u0041 is not decoded twice\"]";
+
+	for (i = 0; i < 100; i++) {
+		rv = nson_parse_json(&nson, NSON_P(doc));
+		assert(rv >= 0);
+		rv = nson_clone(&clone, &nson);
+		assert(rv >= 0);
+
+		rv = pthread_create(&thread, NULL, read_escaped, &clone);
+		assert(rv == 0);
+		assert(read_escaped(&nson));
+		pthread_join(thread, &ok);
+		assert(ok);
+
+		nson_clean(&clone);
+		nson_clean(&nson);
+	}
+	(void)rv;
+	(void)ok;
+}
+
+static void
+select_paths() {
+	int rv;
+	Nson nson = {0};
+	const char *pointers[] = {
+			"/a/1/b", "/c", "/missing", "/a/5", "", "/x~1y/m~0n",
+			"/a/01", "/esc\"aped", "/a/0/1",
+	};
+	bool found[9];
+	const char doc[] = "{\"skip\": [{\"b\": \"]}\"}, [[]]], "
+					   "\"a\": [1, {\"b\": [true, \"v\"]}, 3], \"c\": -2.5, "
+					   "\"x/y\": {\"m~n\": null}, \"esc\\\"aped\": 7}";
+
+	rv = nson_parse_json_select(&nson, NSON_P(doc), pointers, 9, found);
+	assert(rv >= 0);
+	assert(nson_arr_len(&nson) == 9);
+	assert(nson_arr_len(nson_arr_get(&nson, 0)) == 2);
+	assert(strcmp(nson_str(nson_arr_get(nson_arr_get(&nson, 0), 1)), "v") ==
+		   0);
+	assert(nson_real(nson_arr_get(&nson, 1)) == -2.5);
+	assert(nson_type(nson_arr_get(&nson, 2)) == NSON_NIL);
+	assert(nson_type(nson_arr_get(&nson, 3)) == NSON_NIL);
+	assert(nson_type(nson_arr_get(&nson, 4)) == NSON_OBJ);
+	assert(nson_obj_size(nson_arr_get(&nson, 4)) == 5);
+	// null is NSON_NIL just like a missing value
+	assert(nson_type(nson_arr_get(&nson, 5)) == NSON_NIL);
+	assert(nson_type(nson_arr_get(&nson, 6)) == NSON_NIL);
+	assert(nson_int(nson_arr_get(&nson, 7)) == 7);
+	assert(nson_type(nson_arr_get(&nson, 8)) == NSON_NIL);
+	// found tells a null from a missing value
+	assert(found[0] && found[1] && !found[2] && !found[3] && found[4]);
+	assert(found[5] && !found[6] && found[7] && !found[8]);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+select_errors() {
+	int rv;
+	Nson nson = {0};
+	const char *relative[] = {"a"};
+	const char *path[] = {"/a/b"};
+
+	rv = nson_parse_json_select(
+			&nson, NSON_P("{\"a\": 1}"), relative, 1, NULL);
+	assert(rv < 0);
+	rv = nson_parse_json_select(
+			&nson, NSON_P("{\"a\": {\"b\" 1}}"), path, 1, NULL);
+	assert(rv < 0);
+	rv = nson_parse_json_select(
+			&nson, NSON_P("{\"a\": {\"c\": 1"), path, 1, NULL);
+	assert(rv < 0);
+	rv = nson_parse_json_select(
+			&nson, NSON_P("{\"a\": {\"b\": [1}}"), path, 1, NULL);
+	assert(rv < 0);
+
+	// values off the path are not validated
+	rv = nson_parse_json_select(
+			&nson, NSON_P("{\"x\": [nul], \"a\": {\"b\": 1}}"), path, 1, NULL);
+	assert(rv >= 0);
+	assert(nson_int(nson_arr_get(&nson, 0)) == 1);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+select_shared_paths() {
+	int rv;
+	Nson nson = {0};
+	bool found[6];
+	const char *pointers[] = {
+			"/r/b", "/r/a/0", "/r/a/1", "/r/b", "/r/d", "/r/a/x",
+	};
+	const char doc[] = "{\"r\": {\"a\": [1, 2], \"b\": \"x\", \"b\": \"y\"}, "
+					   "\"after\": [nul]}";
+
+	rv = nson_parse_json_select(&nson, NSON_P(doc), pointers, 6, found);
+	assert(rv >= 0);
+	// the last of duplicate keys is selected
+	assert(strcmp(nson_str(nson_arr_get(&nson, 0)), "y") == 0);
+	assert(nson_int(nson_arr_get(&nson, 1)) == 1);
+	assert(nson_int(nson_arr_get(&nson, 2)) == 2);
+	assert(strcmp(nson_str(nson_arr_get(&nson, 3)), "y") == 0);
+	assert(found[0] && found[1] && found[2] && found[3]);
+	assert(!found[4] && !found[5]);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+select_duplicate_keys() {
+	int rv;
+	Nson nson = {0}, full = {0};
+	bool found[3];
+	const char *pointers[] = {"/a/b", "/a/c", "/n"};
+	const char doc[] = "{\"a\": {\"b\": 1}, \"n\": 1, \"a\": {\"c\": 2}, "
+					   "\"n\": 3}";
+
+	rv = nson_parse_json_select(&nson, NSON_P(doc), pointers, 3, found);
+	assert(rv >= 0);
+	rv = nson_parse_json(&full, NSON_P(doc));
+	assert(rv >= 0);
+	// projection agrees with a full parse
+	assert(!found[0]);
+	assert(found[1]);
+	assert(nson_int(nson_arr_get(&nson, 1)) == 2);
+	assert(nson_int(nson_obj_get(nson_obj_get(&full, "a"), "c")) == 2);
+	assert(found[2]);
+	assert(nson_int(nson_arr_get(&nson, 2)) == 3);
+	assert(nson_int(nson_obj_get(&full, "n")) == 3);
+	nson_clean(&full);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+validate_valid() {
+	int rv;
+	size_t i;
+	NsonError err = {0};
+	static const char *const docs[] = {
+			"0", " -1.5e+10 ", "\"\\u00e4\\\"\\/\\b\\f\\n\\r\\t\"", "[]",
+			"{}", "[1, [true, false, null], {\"a\": {\"b\": []}}]",
+			"{\"\xc3\xa4\": \"\xf0\x9f\x98\x80\"}\r\n", "1E-2", "[0.5]",
+	};
+
+	for (i = 0; i < sizeof(docs) / sizeof(*docs); i++) {
+		rv = nson_json_validate(docs[i], strlen(docs[i]), &err);
+		assert(rv >= 0);
+	}
+	(void)rv;
+}
+
+static void
+validate_invalid() {
+	int rv;
+	size_t i;
+	NsonError err = {0};
+	static const struct {
+		const char *doc;
+		size_t offset;
+	} docs[] = {
+			{"", 0},
+			{"[1 2]", 3},
+			{"[1,]", 3},
+			{"{\"a\" 1}", 5},
+			{"{\"a\": 1,}", 8},
+			{"{1: 2}", 1},
+			{"[1}", 2},
+			{"[1] 2", 4},
+			{"01", 0},
+			{"1.", 0},
+			{"-", 0},
+			{"nul", 0},
+			{"truex", 0},
+			{"\"a\\x\"", 3},
+			{"\"\\u12g4\"", 2},
+			{"\"a\tb\"", 2},
+			{"\"abc", 0},
+			{"[\"\xc3\"]", 2},
+			{"[\"\xed\xa0\x80\"]", 2},
+			{"[1,\f2]", 3},
+			{"[[[", 3},
+	};
+
+	for (i = 0; i < sizeof(docs) / sizeof(*docs); i++) {
+		memset(&err, 0, sizeof(err));
+		rv = nson_json_validate(docs[i].doc, strlen(docs[i].doc), &err);
+		assert(rv < 0);
+		assert(err.message != NULL);
+		assert(err.offset == docs[i].offset);
+	}
+	rv = nson_json_validate("[1 2]", 5, NULL);
+	assert(rv < 0);
+	(void)rv;
+}
+
+static void
+validate_invalid_utf8_blocks() {
+	int rv;
+	size_t i, j, len;
+	char doc[256];
+	NsonError err = {0};
+	static const char *const invalid[] = {
+			"\xff", "\x80", "\xc0\x80", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+			"\xe2\x82", "\xf0\x9f\x98",
+	};
+
+	// multibyte text that spans several vector blocks
+	len = 0;
+	doc[len++] = '"';
+	while (len < 200) {
+		memcpy(&doc[len], "\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80", 9);
+		len += 9;
+	}
+	doc[len++] = '"';
+	rv = nson_json_validate(doc, len, &err);
+	assert(rv >= 0);
+
+	for (i = 0; i < sizeof(invalid) / sizeof(*invalid); i++) {
+		// insert the invalid sequence at every character boundary
+		for (j = 1; j + 10 < len; j += 9) {
+			memcpy(&doc[j], invalid[i], strlen(invalid[i]));
+			memset(&doc[j + strlen(invalid[i])], 'a',
+				   9 - strlen(invalid[i]));
+			memset(&err, 0, sizeof(err));
+			rv = nson_json_validate(doc, len, &err);
+			assert(rv < 0);
+			assert(err.offset == j);
+			memcpy(&doc[j], "\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80", 9);
+		}
+	}
+	(void)rv;
+}
+
+static void
+emit_document() {
+	int rv;
+	char *str;
+	size_t size;
+	NsonEmitter emitter;
+	Nson value;
+
+	rv = nson_parse_json(&value, NSON_P("{\"c\":[1,\"d\"]}"));
+	assert(rv >= 0);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_key(&emitter, NSON_P("a"));
+	assert(rv >= 0);
+	rv = nson_emit_begin_array(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_int(&emitter, 1);
+	assert(rv >= 0);
+	rv = nson_emit_real(&emitter, 2.5);
+	assert(rv >= 0);
+	rv = nson_emit_bool(&emitter, true);
+	assert(rv >= 0);
+	rv = nson_emit_null(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_string(&emitter, NSON_P("x\"y"));
+	assert(rv >= 0);
+	rv = nson_emit_end_array(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_key(&emitter, NSON_P("b"));
+	assert(rv >= 0);
+	rv = nson_emit_begin_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_end_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_key(&emitter, NSON_P("v"));
+	assert(rv >= 0);
+	rv = nson_emit_value(&emitter, &value);
+	assert(rv >= 0);
+	rv = nson_emit_end_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv >= 0);
+
+	assert(strcmp(str,
+				  "{\"a\":[1,2.5,true,null,\"x\\\"y\"],\"b\":{},"
+				  "\"v\":{\"c\":[1,\"d\"]}}") == 0);
+	assert(size == strlen(str));
+
+	free(str);
+	nson_clean(&value);
+	(void)rv;
+}
+
+static void
+emit_misuse() {
+	int rv;
+	char *str;
+	size_t size;
+	NsonEmitter emitter;
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_int(&emitter, 1);
+	assert(rv < 0);
+	assert(errno == EINVAL);
+	rv = nson_emit_key(&emitter, NSON_P("a"));
+	assert(rv < 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+	assert(str == NULL);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_array(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_end_object(&emitter);
+	assert(rv < 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_object(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_key(&emitter, NSON_P("a"));
+	assert(rv >= 0);
+	rv = nson_emit_end_object(&emitter);
+	assert(rv < 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_int(&emitter, 1);
+	assert(rv >= 0);
+	rv = nson_emit_int(&emitter, 2);
+	assert(rv < 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_array(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+
+	rv = nson_emit_init(&emitter, 0);
+	assert(rv >= 0);
+	rv = nson_emit_finish(&emitter, &str, &size);
+	assert(rv < 0);
+	(void)rv;
+}
+
+static void
+emit_file() {
+	int rv;
+	char buf[64] = {0};
+	size_t size;
+	NsonEmitter emitter;
+	FILE *file = tmpfile();
+	assert(file != NULL);
+
+	rv = nson_emit_init_fd(&emitter, fileno(file), 0);
+	assert(rv >= 0);
+	rv = nson_emit_begin_array(&emitter);
+	assert(rv >= 0);
+	for (int i = 0; i < 3; i++) {
+		rv = nson_emit_int(&emitter, i);
+		assert(rv >= 0);
+	}
+	rv = nson_emit_end_array(&emitter);
+	assert(rv >= 0);
+	rv = nson_emit_finish(&emitter, NULL, NULL);
+	assert(rv >= 0);
+
+	rewind(file);
+	size = fread(buf, 1, sizeof(buf) - 1, file);
+	assert(size == 7);
+	assert(strcmp(buf, "[0,1,2]") == 0);
+
+	fclose(file);
+	(void)rv;
+	(void)size;
+}
+
+static void
+write_fd() {
+	int rv;
+	char *str, *buf;
+	size_t size, n;
+	char *data = malloc(200000);
+	Nson nson, value;
+	FILE *file = tmpfile();
+	assert(file != NULL);
+	assert(data != NULL);
+
+	for (n = 0; n < 200000; n++) {
+		data[n] = n % 251;
+	}
+	rv = nson_init_arr(&nson);
+	assert(rv >= 0);
+	rv = nson_init_data(&value, data, 200000, NSON_BLOB);
+	assert(rv >= 0);
+	rv = nson_arr_push(&nson, &value);
+	assert(rv >= 0);
+	memset(data, 'a', 100000);
+	data[50000] = '"';
+	rv = nson_init_data(&value, data, 100000, NSON_STR);
+	assert(rv >= 0);
+	rv = nson_arr_push(&nson, &value);
+	assert(rv >= 0);
+	rv = nson_arr_push_int(&nson, 42);
+	assert(rv >= 0);
+
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	rv = nson_json_write_fd(fileno(file), &nson, 0);
+	assert(rv >= 0);
+
+	buf = malloc(size + 1);
+	assert(buf != NULL);
+	rewind(file);
+	n = fread(buf, 1, size + 1, file);
+	assert(n == size);
+	assert(memcmp(buf, str, size) == 0);
+
+	fclose(file);
+	free(data);
+	free(buf);
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+intern_keys() {
+	int rv;
+	Nson nson, clone;
+	Nson *a, *b;
+	// keys that are longer than NSON_INLINE_SIZE
+	const char *doc =
+			"[{\"customer_shipping_address\": \"x\", \"a\\u0062\": 1,"
+			"  \"v\": \"customer_shipping_address\"},"
+			" {\"customer_shipping_address\": \"y\", \"a\\u0062\": 2,"
+			"  \"v\": \"customer_shipping_address\"}]";
+
+	rv = nson_parse_json(&nson, doc, strlen(doc));
+	assert(rv >= 0);
+	a = nson_arr_get(&nson, 0);
+	b = nson_arr_get(&nson, 1);
+
+	assert(nson_obj_get_key(a, 0) == nson_obj_get_key(b, 0));
+	assert(strcmp(nson_obj_get_key(a, 1), "ab") == 0);
+	assert(strcmp(nson_obj_get_key(b, 1), "ab") == 0);
+	assert(nson_obj_get_key(a, 1) != nson_obj_get_key(b, 1));
+	// only keys are interned
+	assert(nson_str(nson_obj_get(a, "v")) != nson_obj_get_key(a, 0));
+	assert(strcmp(nson_str(nson_obj_get(b, "customer_shipping_address")),
+				  "y") == 0);
+
+	rv = nson_clone(&clone, b);
+	assert(rv >= 0);
+	nson_clean(&nson);
+	assert(strcmp(nson_obj_get_key(&clone, 0),
+				  "customer_shipping_address") == 0);
+	assert(nson_int(nson_obj_get(&clone, "ab")) == 2);
+
+	nson_clean(&clone);
+	(void)rv;
+}
+
+static void
+parse_inline_and_null() {
+	int rv;
+	char *str;
+	size_t size;
+	Nson nson;
+	const char *doc = "[null,\"a\\nb\\u00e4\",\"\","
+					  "\"a long string that is not inline\"]";
+	const char *expected = "[null,\"a\\nb\xc3\xa4\",\"\","
+						   "\"a long string that is not inline\"]";
+
+	rv = nson_parse_json(&nson, doc, strlen(doc));
+	assert(rv >= 0);
+	assert(nson_type(nson_arr_get(&nson, 0)) == NSON_NIL);
+	assert(strcmp(nson_str(nson_arr_get(&nson, 1)), "a\nb\xc3\xa4") == 0);
+	assert(nson_data_len(nson_arr_get(&nson, 1)) == 5);
+	assert(nson_data_len(nson_arr_get(&nson, 2)) == 0);
+
+	rv = nson_json_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	assert(strcmp(str, expected) == 0);
+
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
 DEFINE
 TEST(parse_true);
 TEST(parse_double);
 TEST(parse_number);
+TEST(parse_exponent);
+TEST(parse_negative_real);
+TEST(parse_real_correctly_rounded);
+TEST(parse_int_overflow);
+TEST(parse_invalid_number);
 TEST(parse_empty_string);
 TEST(parse_string_escape_newline);
 TEST(parse_string_escape_newline2);
+TEST(parse_string_escaped_quote);
+TEST(parse_string_lazy_unescape);
+TEST(parse_string_across_blocks);
+TEST(trailing_garbage_in_scalar);
 TEST(object_with_one_element);
 TEST(object_with_multiple_elements);
+TEST(parse_wide_array);
+TEST(mismatched_brackets);
 TEST(access_str_as_arr);
 TEST(leading_whitespace);
 TEST(unclosed_array);
@@ -482,10 +1687,39 @@ TEST(utf8_0800);
 TEST(utf8_FFFF);
 TEST(stringify_utf8);
 TEST(stringify_nullbyte);
+TEST(stringify_escapes);
+TEST(stringify_escapes_long);
+TEST(stringify_ascii);
 TEST(stringify_empty_array);
 TEST(stringify_empty_object);
 TEST(stringify_object);
+TEST(stringify_numbers);
+TEST(stringify_real_roundtrip);
+TEST(write_file);
+TEST(incremental_parse_chunks);
+TEST(incremental_parse_scalar);
+TEST(incremental_parse_errors);
+TEST(incremental_parse_non_string_keys);
+TEST(events_parse);
+TEST(events_abort);
+TEST(events_invalid);
+TEST(thread_parse_array);
+TEST(thread_parse_errors);
+TEST(clone_read_concurrently);
+TEST(select_paths);
+TEST(select_errors);
+TEST(select_shared_paths);
+TEST(select_duplicate_keys);
+TEST(validate_valid);
+TEST(validate_invalid);
+TEST(validate_invalid_utf8_blocks);
+TEST(emit_document);
+TEST(emit_misuse);
+TEST(emit_file);
+TEST(intern_keys);
+TEST(parse_inline_and_null);
 TEST(stringify_data);
+TEST(write_fd);
 TEST(fuzz_parse_crash);
 TEST(fuzz_parse_leak);
 TEST(fuzz_parse_leak2);
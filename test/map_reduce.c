@@ -73,6 +73,11 @@ check_encode_base64() {
 	nson_init_str(&nson, "Hello Wor");
 	nson_mapper_b64_enc(0, &nson, NULL);
 	assert(strcmp("SGVsbG8gV29y", nson_str(&nson)) == 0);
+	nson_clean(&nson);
+
+	nson_init_str(&nson, "\xff\xfe\xfd\x80");
+	nson_mapper_b64_enc(0, &nson, NULL);
+	assert(strcmp("//79gA==", nson_str(&nson)) == 0);
 
 	nson_clean(&nson);
 }
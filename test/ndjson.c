@@ -0,0 +1,151 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "common.h"
+#include "test.h"
+
+#include "../src/nson.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static void
+parse_lines() {
+	int rv;
+	Nson nson = {0};
+	const char doc[] = "{\"a\": 1}\n[2, 3]\r\n\n  \n\"four\"\n5";
+
+	rv = nson_parse_ndjson(&nson, NSON_P(doc));
+	assert(rv >= 0);
+	assert(nson_type(&nson) == NSON_ARR);
+	assert(nson_arr_len(&nson) == 4);
+	assert(nson_int(nson_obj_get(nson_arr_get(&nson, 0), "a")) == 1);
+	assert(nson_arr_len(nson_arr_get(&nson, 1)) == 2);
+	assert(strcmp(nson_str(nson_arr_get(&nson, 2)), "four") == 0);
+	assert(nson_int(nson_arr_get(&nson, 3)) == 5);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_empty() {
+	int rv;
+	Nson nson = {0};
+
+	rv = nson_parse_ndjson(&nson, NSON_P("\n\n"));
+	assert(rv >= 0);
+	assert(nson_type(&nson) == NSON_ARR);
+	assert(nson_arr_len(&nson) == 0);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+parse_invalid_line() {
+	int rv;
+	Nson nson = {0};
+
+	rv = nson_parse_ndjson(&nson, NSON_P("1\n[2\n3"));
+	assert(rv < 0);
+	rv = nson_parse_ndjson(&nson, NSON_P("1\n2 3\n4"));
+	assert(rv < 0);
+	(void)rv;
+}
+
+static void
+parse_threads_in_order() {
+	int rv;
+	size_t i, len = 0;
+	char *doc = NULL;
+	Nson nson = {0}, errors = {0};
+	FILE *stream = open_memstream(&doc, &len);
+	NsonThreadMapSettings settings = {
+			.threads = 4,
+			.chunk_size = 3,
+	};
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 7 == 3) {
+			fprintf(stream, "{\"broken\": %zu\n", i);
+		} else {
+			fprintf(stream, "{\"line\": %zu}\n", i);
+		}
+	}
+	fclose(stream);
+
+	rv = nson_parse_ndjson_ext(&settings, &nson, &errors, doc, len);
+	assert(rv >= 0);
+	assert(nson_arr_len(&errors) == 1000 / 7 + 1);
+	assert(nson_arr_len(&nson) + nson_arr_len(&errors) == 1000);
+	for (i = 0; i < nson_arr_len(&errors); i++) {
+		// line numbers are 1-based
+		assert(nson_int(nson_arr_get(&errors, i)) == i * 7 + 4);
+	}
+	for (i = 1; i < nson_arr_len(&nson); i++) {
+		assert(nson_int(nson_obj_get(nson_arr_get(&nson, i - 1), "line")) <
+			   nson_int(nson_obj_get(nson_arr_get(&nson, i), "line")));
+	}
+	nson_clean(&nson);
+	nson_clean(&errors);
+
+	rv = nson_parse_ndjson_ext(&settings, &nson, NULL, doc, len);
+	assert(rv < 0);
+
+	free(doc);
+	(void)rv;
+}
+
+static void
+load_file() {
+	int rv;
+	Nson nson = {0};
+	char path[] = "/tmp/nson-ndjson-XXXXXX";
+	const char content[] = "{\"id\": 1}\n{\"id\": 2}\n";
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	assert(write(fd, content, sizeof(content) - 1) == sizeof(content) - 1);
+	close(fd);
+
+	rv = nson_load_ndjson(&nson, path);
+	assert(rv >= 0);
+	assert(nson_arr_len(&nson) == 2);
+	assert(nson_int(nson_obj_get(nson_arr_get(&nson, 1), "id")) == 2);
+	nson_clean(&nson);
+
+	unlink(path);
+	(void)rv;
+}
+
+DEFINE
+TEST(parse_lines);
+TEST(parse_empty);
+TEST(parse_invalid_line);
+TEST(parse_threads_in_order);
+TEST(load_file);
+DEFINE_END
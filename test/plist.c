@@ -290,6 +290,21 @@ parse_object_spaces() {
 	(void)rv;
 }
 
+static void
+parse_mismatched_close() {
+	int rv;
+	Nson nson = {0};
+	rv = nson_parse_plist(&nson, PLIST("<array><true/></dict>"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	rv = nson_parse_plist(&nson, PLIST("<dict><key>k</key></dict>"));
+	assert(rv < 0);
+	nson_clean(&nson);
+
+	(void)rv;
+}
+
 static void
 parse_data() {
 	int rv;
@@ -327,6 +342,28 @@ stringify_object_with_2_members() {
 	(void)rv;
 }
 
+static void
+stringify_numbers() {
+	int rv;
+	Nson nson = {0};
+	char *str;
+	size_t size;
+
+	rv = NSON(&nson, [ 2.3, 1e-7, -17 ]);
+	assert(rv >= 0);
+	nson_plist_serialize(&str, &size, &nson, NSON_SKIP_HEADER);
+	assert(strcmp(str,
+				  "<array>"
+				  "<real>2.3</real>"
+				  "<real>1e-7</real>"
+				  "<integer>-17</integer>"
+				  "</array>") == 0);
+
+	nson_clean(&nson);
+	free(str);
+	(void)rv;
+}
+
 static void
 stringify_data() {
 	int rv;
@@ -362,6 +399,28 @@ stringify_escape() {
 	(void)rv;
 }
 
+static void
+stringify_control_characters() {
+	int rv;
+	Nson nson = {0}, parsed = {0};
+	char *str;
+	size_t size;
+
+	rv = nson_init_str(&nson, "a\x01" "b\x1f");
+	assert(rv >= 0);
+	nson_plist_serialize(&str, &size, &nson, 0);
+	assert(strstr(str, "<string>a&#1;b&#31;</string>"));
+
+	rv = nson_parse_plist(&parsed, str, size);
+	assert(rv >= 0);
+	assert(strcmp(nson_str(&parsed), "a\x01" "b\x1f") == 0);
+
+	nson_clean(&parsed);
+	nson_clean(&nson);
+	free(str);
+	(void)rv;
+}
+
 static void
 stringify_true() {
 	int rv;
@@ -443,6 +502,73 @@ INPUT_CHECK(
 
 INPUT_CHECK(fuzz_parse_crash9, plist, "")
 
+static void
+write_fd() {
+	int rv;
+	char *str, *buf;
+	size_t size, n;
+	char *data = malloc(200000);
+	Nson nson, value;
+	FILE *file = tmpfile();
+	assert(file != NULL);
+	assert(data != NULL);
+
+	for (n = 0; n < 200000; n++) {
+		data[n] = n % 251;
+	}
+	rv = nson_init_arr(&nson);
+	assert(rv >= 0);
+	rv = nson_init_data(&value, data, 200000, NSON_BLOB);
+	assert(rv >= 0);
+	rv = nson_arr_push(&nson, &value);
+	assert(rv >= 0);
+	rv = nson_arr_push_int(&nson, 42);
+	assert(rv >= 0);
+
+	rv = nson_plist_serialize(&str, &size, &nson, 0);
+	assert(rv >= 0);
+	rv = nson_plist_write_fd(fileno(file), &nson, 0);
+	assert(rv >= 0);
+
+	buf = malloc(size + 1);
+	assert(buf != NULL);
+	rewind(file);
+	n = fread(buf, 1, size + 1, file);
+	assert(n == size);
+	assert(memcmp(buf, str, size) == 0);
+
+	fclose(file);
+	free(data);
+	free(buf);
+	free(str);
+	nson_clean(&nson);
+	(void)rv;
+}
+
+static void
+stringify_nil() {
+	int rv;
+	Nson nson = {0};
+	char *str;
+	size_t size;
+
+	rv = nson_parse_json(&nson, NSON_P("{\"a\": null, \"b\": [1, null]}"));
+	assert(rv >= 0);
+	rv = nson_plist_serialize(&str, &size, &nson, NSON_SKIP_HEADER);
+	assert(rv >= 0);
+	// plists have no null, it is written as an empty string
+	assert(strcmp(str,
+				  "<dict>"
+				  "<key>a</key><string></string>"
+				  "<key>b</key><array><integer>1</integer>"
+				  "<string></string></array>"
+				  "</dict>") == 0);
+
+	nson_clean(&nson);
+	free(str);
+	(void)rv;
+}
+
 DEFINE
 TEST(parse_real);
 TEST(parse_int);
@@ -463,10 +589,15 @@ TEST(parse_object_empty);
 TEST(parse_object_1);
 TEST(parse_object_2);
 TEST(parse_object_spaces);
+TEST(parse_mismatched_close);
 TEST(parse_data);
 TEST(stringify_object_with_2_members);
+TEST(stringify_nil);
+TEST(stringify_numbers);
 TEST(stringify_data);
+TEST(write_fd);
 TEST(stringify_escape);
+TEST(stringify_control_characters);
 TEST(stringify_true);
 TEST(fuzz_parse_memleak);
 TEST(fuzz_parse_assert);